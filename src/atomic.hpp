@@ -0,0 +1,30 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "bitops.hpp"
+
+namespace hal {
+
+constexpr uintptr_t CSREG = 0x5F;
+
+// Disables interrupts for its lifetime and restores the previous state afterwards,
+// unlike a cli() sei() pair it does not enable interrupts when used inside an interrupt
+class InterruptLock {
+    const uint8_t _sreg;
+
+   public:
+    InterruptLock() : _sreg(readByte(CSREG)) { cli(); }
+
+    ~InterruptLock() {
+        // Keeps the compiler from moving memory accesses out of the locked section
+        __asm__ __volatile__("" ::: "memory");
+        setByte(CSREG, _sreg);
+    }
+
+    InterruptLock(const InterruptLock&) = delete;
+    InterruptLock& operator=(const InterruptLock&) = delete;
+};
+
+}  // namespace hal
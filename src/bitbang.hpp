@@ -0,0 +1,399 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.hpp"
+#include "concepts.hpp"
+#include "format.hpp"
+#include "pins.hpp"
+#include "spibus.hpp"
+#include "twibus.hpp"
+
+namespace hal {
+
+/*
+ * Software buses on any io_digital_pin, for when the hardware ones are taken.
+ * Bit times are computed at compile time from F_CPU and the rate, the waits are cycle exact busy loops.
+ * OVERHEAD is what the pin accesses of one half bit take already, about 2 cycles each with Pin<Port, N>
+ * and 6 to 10 with DigitalPin, so the same rate needs a smaller OVERHEAD with the zero-size pins.
+ * The rates are upper bounds, a bus never runs faster than its pin accesses allow.
+ *
+ * They offer the blocking parts of the hardware drivers, code written against SPI, TWI or Serial
+ * only needs its bus object swapped:
+ *
+ *     SoftSPI<Pin<PortD, 2>, Pin<PortD, 3>, Pin<PortD, 4>, 2000000, SPIMode::MODE3> spi;
+ *     SoftI2C<DigitalPin, DigitalPin> i2c(CPC0, CPC1);
+ *     SoftSerial<DigitalPin, DigitalPin, 9600> console(CPD7, CPD7);
+ */
+
+// Busy waits CYCLES clock cycles, nothing when the pin accesses already take longer
+template <int32_t CYCLES>
+inline void delayCycles() {
+    if constexpr (CYCLES > 0) {
+        __builtin_avr_delay_cycles(CYCLES);
+    }
+}
+
+// Half of the bit time in cycles, without the pin access overhead
+constexpr int32_t halfBitCycles(uint32_t rate, uint8_t overhead) {
+    return static_cast<int32_t>(F_CPU / rate / 2) - overhead;
+}
+
+/*
+ * SPI master in all 4 modes, the mode, clock and bit order are fixed by the template,
+ * the devices only supply the chip select.
+ */
+template <io_digital_pin SCK_PIN, io_digital_pin MOSI_PIN, io_digital_pin MISO_PIN, uint32_t CLOCK = 1000000,
+          SPIMode MODE = SPIMode::MODE0, SPIBitOrder ORDER = SPIBitOrder::MSB_FIRST, uint8_t OVERHEAD = 4>
+class SoftSPI {
+    static constexpr int32_t HALF = halfBitCycles(CLOCK, OVERHEAD);
+    static constexpr bool IDLE = MODE == SPIMode::MODE2 || MODE == SPIMode::MODE3;
+    // Data is sampled on the second clock edge of the bit instead of the first one
+    static constexpr bool LATE = MODE == SPIMode::MODE1 || MODE == SPIMode::MODE3;
+    static constexpr bool MSB = ORDER == SPIBitOrder::MSB_FIRST;
+    // Both bytes move by one bit per clock, the bit on the wire is always bit 7 or bit 0
+    static constexpr uint8_t OUT_BIT = MSB ? 0x80 : 0x01;
+    static constexpr uint8_t IN_BIT = MSB ? 0x01 : 0x80;
+
+    [[no_unique_address]] const SCK_PIN _sck;
+    [[no_unique_address]] const MOSI_PIN _mosi;
+    [[no_unique_address]] const MISO_PIN _miso;
+
+   public:
+    constexpr SoftSPI(const SCK_PIN& sck = SCK_PIN{}, const MOSI_PIN& mosi = MOSI_PIN{},
+                      const MISO_PIN& miso = MISO_PIN{})
+        : _sck(sck), _mosi(mosi), _miso(miso) {}
+
+    void begin() const {
+        _sck.digitalWrite(IDLE);
+        pinMode(_sck, OUTPUT);
+        _sck.digitalWrite(IDLE);
+        pinMode(_mosi, OUTPUT);
+        pinMode(_miso, INPUT);
+    }
+
+    void end() const {
+        pinMode(_sck, INPUT);
+        pinMode(_mosi, INPUT);
+    }
+
+    void attach(const SPIDevice& device) const {
+        device.deselect();
+        pinMode(device.chip_select, OUTPUT);
+        device.deselect();
+    }
+
+    void beginTransaction(const SPIDevice& device) const { device.select(); }
+
+    void endTransaction(const SPIDevice& device) const { device.deselect(); }
+
+    uint8_t transfer(uint8_t data) const {
+        uint8_t received = 0;
+        for (uint8_t i = 0; i < 8; ++i) {
+            bool out = data & OUT_BIT;
+            data = MSB ? data << 1 : data >> 1;
+            received = MSB ? received << 1 : received >> 1;
+            if (!LATE) {
+                _mosi.digitalWrite(out);
+            }
+            delayCycles<HALF>();
+            _sck.digitalWrite(!IDLE);
+            if (LATE) {
+                _mosi.digitalWrite(out);
+            } else if (_miso.digitalRead()) {
+                received |= IN_BIT;
+            }
+            delayCycles<HALF>();
+            _sck.digitalWrite(IDLE);
+            if (LATE && _miso.digitalRead()) {
+                received |= IN_BIT;
+            }
+        }
+        return received;
+    }
+
+    void transfer(const uint8_t* tx, uint8_t* rx, uint16_t length) const {
+        for (uint16_t i = 0; i < length; ++i) {
+            rx[i] = transfer(tx[i]);
+        }
+    }
+
+    void send(const uint8_t* tx, uint16_t length) const {
+        for (uint16_t i = 0; i < length; ++i) {
+            transfer(tx[i]);
+        }
+    }
+
+    void receive(uint8_t* rx, uint16_t length, uint8_t fill = 0xFF) const {
+        for (uint16_t i = 0; i < length; ++i) {
+            rx[i] = transfer(fill);
+        }
+    }
+};
+
+/*
+ * I2C master with open drain emulation, a line is released as an input and pulled low as an output,
+ * so both lines need external pull-ups. Slaves may stretch the clock up to about STRETCH_LIMIT loops,
+ * longer and the transaction fails as a bus error. Transactions run to the end inside submit().
+ */
+template <io_digital_pin SDA_PIN, io_digital_pin SCL_PIN, uint32_t FREQUENCY = 400000, uint8_t OVERHEAD = 8,
+          uint16_t STRETCH_LIMIT = 10000>
+class SoftI2C {
+    static constexpr int32_t HALF = halfBitCycles(FREQUENCY, OVERHEAD);
+
+    [[no_unique_address]] const SDA_PIN _sda;
+    [[no_unique_address]] const SCL_PIN _scl;
+    uint8_t _nacks = 0;
+    uint8_t _bus_errors = 0;
+
+    void sdaLow() const { _sda.setOutputMode(); }
+
+    void sdaRelease() const { _sda.setInputMode(); }
+
+    void sclLow() const { _scl.setOutputMode(); }
+
+    // False when a slave holds SCL low for too long
+    bool sclRelease() const {
+        _scl.setInputMode();
+        for (uint16_t i = 0; !_scl.digitalRead(); ++i) {
+            if (i == STRETCH_LIMIT) return false;
+        }
+        return true;
+    }
+
+    // Also the repeated start, SCL is low on entry then
+    bool start() const {
+        sdaRelease();
+        delayCycles<HALF>();
+        if (!sclRelease()) return false;
+        delayCycles<HALF>();
+        sdaLow();
+        delayCycles<HALF>();
+        sclLow();
+        return true;
+    }
+
+    void stop() const {
+        sdaLow();
+        delayCycles<HALF>();
+        sclRelease();
+        delayCycles<HALF>();
+        sdaRelease();
+        delayCycles<HALF>();
+    }
+
+    // One bit, the returned level is sampled while SCL is high
+    bool clock(bool bit_value, bool& level) const {
+        if (bit_value) {
+            sdaRelease();
+        } else {
+            sdaLow();
+        }
+        delayCycles<HALF>();
+        if (!sclRelease()) return false;
+        delayCycles<HALF>();
+        level = _sda.digitalRead();
+        sclLow();
+        return true;
+    }
+
+    // Sends a byte, ACK tells whether the slave acknowledged it
+    bool writeByte(uint8_t data, bool& ack) const {
+        bool level;
+        for (uint8_t i = 0; i < 8; ++i) {
+            if (!clock(data & (0x80 >> i), level)) return false;
+        }
+        if (!clock(true, level)) return false;
+        ack = !level;
+        return true;
+    }
+
+    bool readByte(uint8_t& data, bool ack) const {
+        bool level;
+        data = 0;
+        for (uint8_t i = 0; i < 8; ++i) {
+            if (!clock(true, level)) return false;
+            data = (data << 1) | (level ? 1 : 0);
+        }
+        return clock(!ack, level);
+    }
+
+    TWIResult execute(TWITransaction& transaction) {
+        bool ack = false;
+        if (transaction.tx_length > 0 || transaction.rx_length == 0) {
+            if (!start() || !writeByte(transaction.address << 1, ack)) return TWIResult::BUS_ERROR;
+            if (!ack) return TWIResult::ADDRESS_NACK;
+            for (uint8_t i = 0; i < transaction.tx_length; ++i) {
+                if (!writeByte(transaction.tx[i], ack)) return TWIResult::BUS_ERROR;
+                if (!ack) return TWIResult::DATA_NACK;
+            }
+        }
+        if (transaction.rx_length > 0) {
+            if (!start() || !writeByte((transaction.address << 1) | 1, ack)) return TWIResult::BUS_ERROR;
+            if (!ack) return TWIResult::ADDRESS_NACK;
+            for (uint8_t i = 0; i < transaction.rx_length; ++i) {
+                // The last byte is answered with a NACK
+                if (!readByte(transaction.rx[i], i + 1 < transaction.rx_length)) return TWIResult::BUS_ERROR;
+            }
+        }
+        return TWIResult::OK;
+    }
+
+   public:
+    constexpr SoftI2C(const SDA_PIN& sda = SDA_PIN{}, const SCL_PIN& scl = SCL_PIN{}) : _sda(sda), _scl(scl) {}
+
+    // Both lines released, the output latches stay low so switching to output pulls the line down
+    void begin() const {
+        sdaRelease();
+        sclRelease();
+        _sda.digitalWrite(false);
+        _scl.digitalWrite(false);
+    }
+
+    void end() const {
+        sdaRelease();
+        _scl.setInputMode();
+    }
+
+    bool submit(TWITransaction& transaction) {
+        TWIResult result = execute(transaction);
+        if (result == TWIResult::ADDRESS_NACK || result == TWIResult::DATA_NACK) {
+            _nacks = _nacks + (_nacks < 0xFF);
+        } else if (result == TWIResult::BUS_ERROR) {
+            _bus_errors = _bus_errors + (_bus_errors < 0xFF);
+        }
+        stop();
+        transaction.result = result;
+        transaction.done = true;
+        if (transaction.callback) {
+            transaction.callback(transaction);
+        }
+        return true;
+    }
+
+    TWIResult run(TWITransaction& transaction) {
+        submit(transaction);
+        return transaction.result;
+    }
+
+    bool busy() const { return false; }
+
+    void flush() const {}
+
+    uint8_t nacks() const { return _nacks; }
+
+    // A single master, nobody to lose against
+    uint8_t arbitrationLosses() const { return 0; }
+
+    uint8_t busErrors() const { return _bus_errors; }
+
+    void resetCounters() {
+        _nacks = 0;
+        _bus_errors = 0;
+    }
+};
+
+/*
+ * Half-duplex UART, 8N1, the same pin may be used for both directions on single wire buses.
+ * Interrupts are off for every byte, one byte at 9600 baud keeps them off for about 1 ms.
+ * TX is an output only while sending, between bytes it idles as an input with the pull-up.
+ */
+template <io_digital_pin TX_PIN, io_digital_pin RX_PIN, uint32_t BAUD = 9600, uint8_t OVERHEAD = 8>
+class SoftSerial {
+    static constexpr int32_t BIT = 2 * halfBitCycles(BAUD, OVERHEAD / 2);
+    static constexpr int32_t HALF = halfBitCycles(BAUD, OVERHEAD);
+    // Loops of the start bit wait per millisecond, one loop takes about 8 cycles
+    static constexpr uint32_t WAIT_LOOPS_PER_MS = F_CPU / 8000;
+
+    [[no_unique_address]] const TX_PIN _tx;
+    [[no_unique_address]] const RX_PIN _rx;
+    uint16_t _timeout_ms = 1000;
+
+   public:
+    constexpr SoftSerial(const TX_PIN& tx = TX_PIN{}, const RX_PIN& rx = RX_PIN{}) : _tx(tx), _rx(rx) {}
+
+    void begin() const {
+        _tx.digitalWrite(true);
+        pinMode(_tx, INPUT);
+        _tx.digitalWrite(true);
+        pinMode(_rx, INPUT);
+        _rx.digitalWrite(true);
+    }
+
+    void end() const { pinMode(_tx, INPUT); }
+
+    // How long read() waits for a start bit
+    void setTimeout(uint16_t ms) { _timeout_ms = ms; }
+
+    uintptr_t write(uint8_t val) const {
+        InterruptLock lock;
+        _tx.digitalWrite(true);
+        pinMode(_tx, OUTPUT);
+        _tx.digitalWrite(false);
+        delayCycles<BIT>();
+        for (uint8_t i = 0; i < 8; ++i) {
+            _tx.digitalWrite(val & 1);
+            val >>= 1;
+            delayCycles<BIT>();
+        }
+        _tx.digitalWrite(true);
+        delayCycles<BIT>();
+        pinMode(_tx, INPUT);
+        _tx.digitalWrite(true);
+        return 1;
+    }
+
+    uintptr_t write(const char* str) const {
+        uintptr_t count = 0;
+        while (*str) {
+            count += write(static_cast<uint8_t>(*str++));
+        }
+        return count;
+    }
+
+    uintptr_t print(const char* str) const { return write(str); }
+
+    uintptr_t print(long val, Format format = Format::DEC) const {
+        char buf[8 * sizeof(long) + 1];
+        return print(ltoa(val, buf, format));
+    }
+
+    uintptr_t println(const char* str) const { return print(str) + print("\r\n"); }
+
+    uintptr_t println(long val, Format format = Format::DEC) const { return print(val, format) + print("\r\n"); }
+
+    // Waits for a start bit up to the timeout, -1 when none came
+    int read() const {
+        uint32_t loops = static_cast<uint32_t>(_timeout_ms) * WAIT_LOOPS_PER_MS;
+        while (_rx.digitalRead()) {
+            if (loops-- == 0) return -1;
+        }
+        InterruptLock lock;
+        // Middle of the start bit, then the middle of every data bit
+        delayCycles<HALF>();
+        uint8_t val = 0;
+        for (uint8_t i = 0; i < 8; ++i) {
+            delayCycles<BIT>();
+            val >>= 1;
+            if (_rx.digitalRead()) {
+                val |= 0x80;
+            }
+        }
+        // Into the stop bit, so the next read does not take the last data bit for a start bit
+        delayCycles<BIT>();
+        return val;
+    }
+
+    uintptr_t readBytes(uint8_t* buf, uintptr_t len) const {
+        uintptr_t count = 0;
+        while (count < len) {
+            int val = read();
+            if (val < 0) break;
+            buf[count++] = val;
+        }
+        return count;
+    }
+};
+
+}  // namespace hal
@@ -64,4 +64,10 @@ uint8_t readByte(uintptr_t addr) {
 
 uint16_t readShort(uintptr_t addr) { return readByte(addr) | (readByte(addr + 1) << 8); }
 
+// 16 bit registers latch the high byte into TEMP, so it has to go first
+void setShort(uintptr_t addr, uint16_t val) {
+    setByte(addr + 1, highByte(val));
+    setByte(addr, lowByte(val));
+}
+
 }  // namespace hal
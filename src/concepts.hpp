@@ -60,6 +60,7 @@ template <typename T>
 concept pwm_pin = requires(const T& t) {
     {t.setPWM((unsigned char){})};
     {t.setupPWM()};
+    { t.isPWMEnabled() } -> convertible_to<bool>;
 };
 
 template <typename T>
@@ -67,3 +68,32 @@ concept analog_readable = requires(const T& t) {
     {t.setupAnalogRead()};
     {t.analogRead() } -> convertible_to<unsigned short>;
 };
+
+template <typename T>
+concept sample_filter = requires(T& t) {
+    {t.add((unsigned short){})};
+    {t.value()};
+    {t.reset()};
+};
+
+// Speed in counts per call, read once per control loop
+template <typename T>
+concept speed_feedback = requires(T& t) {
+    { t.speed() } -> convertible_to<short>;
+};
+
+// Storage in 512 byte blocks, like SDCard
+template <typename T>
+concept block_device = requires(T& t, unsigned long block, unsigned char* data) {
+    { t.readBlock(block, data) } -> convertible_to<bool>;
+    { t.writeBlock(block, data) } -> convertible_to<bool>;
+};
+
+// Block storage that also streams runs of consecutive blocks, like SDCard, busy() while it programs
+template <typename T>
+concept stream_block_device = block_device<T> && requires(T& t, unsigned long block, const unsigned char* data) {
+    { t.writeStart(block, block) } -> convertible_to<bool>;
+    { t.writeData(data) } -> convertible_to<bool>;
+    { t.writeStop() } -> convertible_to<bool>;
+    { t.busy() } -> convertible_to<bool>;
+};
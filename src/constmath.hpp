@@ -0,0 +1,33 @@
+#pragma once
+
+namespace hal {
+
+/*
+ * Math for compile time table generation, consteval so no floating point code ends up in the binary.
+ */
+
+consteval double constLn(double x) {
+    constexpr double LN2 = 0.693147180559945309417;
+    // x = m * 2^k with m in [1, 2)
+    int k = 0;
+    while (x >= 2.0) {
+        x /= 2.0;
+        ++k;
+    }
+    while (x < 1.0) {
+        x *= 2.0;
+        --k;
+    }
+    // ln(m) = 2 * atanh((m - 1) / (m + 1)), the series converges fast for m in [1, 2)
+    double y = (x - 1.0) / (x + 1.0);
+    double y2 = y * y;
+    double term = y;
+    double sum = 0.0;
+    for (int n = 1; n < 40; n += 2) {
+        sum += term / n;
+        term *= y2;
+    }
+    return 2.0 * sum + k * LN2;
+}
+
+}  // namespace hal
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "ringbuf.hpp"
+
+namespace hal {
+
+/*
+ * Debounces up to 8 buttons of one port together, using a 2 bit vertical counter per pin.
+ * Every tick samples PINx once, a pin changes its debounced state after 4 equal samples in a row.
+ * Call tick() at a fixed rate, every 5 to 10 ms, from a timer interrupt or the main loop.
+ *
+ *     PortDebouncer<> buttons(CPD2, CPD4, CPD7);
+ *     buttons.begin();
+ *     ...
+ *     while (buttons.available()) {
+ *         auto event = buttons.read();
+ *     }
+ */
+
+enum class ButtonAction : uint8_t {
+    NONE = 0,
+    PRESS = 1,
+    RELEASE = 2,
+    // Held for LONG_TICKS, reported once per press
+    LONG_PRESS = 3,
+};
+
+struct ButtonEvent {
+    ButtonAction action;
+    // Bit of the pin within its port
+    uint8_t pin;
+};
+
+// Not constexpr on purpose, constant initialization of a debouncer on two ports fails the compilation
+void debouncerPinsOnDifferentPorts();
+
+template <uint8_t LONG_TICKS = 100, uint8_t QUEUE_SIZE = 16>
+class PortDebouncer {
+    static_assert(LONG_TICKS > 0, "Long press needs at least one tick");
+
+    const uintptr_t INPUT_ADDR;
+    const uint8_t MASK;
+    // Pins which read low when pressed
+    uint8_t _active_low = 0;
+
+    // Debounced state, 1 is pressed
+    volatile uint8_t _state = 0;
+    uint8_t _count0 = 0xFF;
+    uint8_t _count1 = 0xFF;
+    uint8_t _long_reported = 0;
+    uint8_t _held[8] = {};
+    RingBuffer<QUEUE_SIZE> _events;
+
+    // Events are packed as action in the high bits and the pin in the low 3 bits
+    void push(ButtonAction action, uint8_t changed) {
+        for (uint8_t pin = 0; pin < 8; ++pin) {
+            if (changed & (1 << pin)) {
+                _events.add((static_cast<uint8_t>(action) << 3) | pin);
+            }
+        }
+    }
+
+   public:
+    template <typename... Pins>
+    constexpr PortDebouncer(const DigitalPin& first, const Pins&... rest)
+        : INPUT_ADDR(first.inputAddress()), MASK((first.mask() | ... | rest.mask())) {
+        if (((rest.inputAddress() != first.inputAddress()) || ...)) {
+            debouncerPinsOnDifferentPorts();
+        }
+    }
+
+    // Buttons to ground use the internal pull-ups, buttons to VCC need external pull-downs
+    void begin(bool active_low = true) {
+        // DDRx and PORTx follow PINx
+        setByte(INPUT_ADDR + 1, readByte(INPUT_ADDR + 1) & ~MASK);
+        uint8_t port = readByte(INPUT_ADDR + 2);
+        setByte(INPUT_ADDR + 2, active_low ? port | MASK : port & ~MASK);
+        InterruptLock lock;
+        _active_low = active_low ? MASK : 0;
+        _state = (readByte(INPUT_ADDR) ^ _active_low) & MASK;
+        _count0 = 0xFF;
+        _count1 = 0xFF;
+    }
+
+    void tick() {
+        uint8_t sample = (readByte(INPUT_ADDR) ^ _active_low) & MASK;
+        uint8_t state = _state;
+        // Pins differing from the debounced state count down, the others are reset to 3
+        uint8_t delta = state ^ sample;
+        _count0 = ~(_count0 & delta);
+        _count1 = _count0 ^ (_count1 & delta);
+        // Wrapped from 0 to 3, four samples in a row disagreed with the state
+        uint8_t toggle = delta & _count0 & _count1;
+        state ^= toggle;
+        _state = state;
+
+        if (toggle != 0) {
+            push(ButtonAction::PRESS, toggle & state);
+            uint8_t released = toggle & ~state;
+            push(ButtonAction::RELEASE, released);
+            _long_reported &= ~released;
+            for (uint8_t pin = 0; pin < 8; ++pin) {
+                if (released & (1 << pin)) {
+                    _held[pin] = 0;
+                }
+            }
+        }
+
+        // Only pressed buttons, which did not report a long press yet, count
+        uint8_t held = state & ~_long_reported;
+        if (held == 0) return;
+        for (uint8_t pin = 0; pin < 8; ++pin) {
+            uint8_t mask = 1 << pin;
+            if ((held & mask) && ++_held[pin] == LONG_TICKS) {
+                _long_reported |= mask;
+                push(ButtonAction::LONG_PRESS, mask);
+            }
+        }
+    }
+
+    // Debounced state of the port, 1 is pressed
+    uint8_t pressed() const { return _state; }
+
+    bool isPressed(const DigitalPin& pin) const { return _state & pin.mask(); }
+
+    bool available() const {
+        InterruptLock lock;
+        return !_events.empty();
+    }
+
+    // Oldest event, NONE when there is none. The queue drops the oldest events when full
+    ButtonEvent read() {
+        InterruptLock lock;
+        if (_events.empty()) {
+            return ButtonEvent{ButtonAction::NONE, 0};
+        }
+        uint8_t event = _events.peek();
+        _events.remove();
+        return ButtonEvent{static_cast<ButtonAction>(event >> 3), static_cast<uint8_t>(event & 0b111)};
+    }
+};
+
+}  // namespace hal
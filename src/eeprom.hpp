@@ -0,0 +1,302 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "resources.hpp"
+#include "timers.hpp"
+
+namespace hal {
+
+/*
+ * EEPROM writes without waiting, a cell takes up to 3.4 ms to program and the EE_READY interrupt
+ * starts the next one from a queue. write() only queues, cells which already hold the value are skipped,
+ * and cells which only lose bits or are set to 0xFF take the 1.8 ms write only or erase only mode.
+ * A cell queued twice is programmed once with the newer value.
+ *
+ *     EEPROM.write(0x10, &calibration, sizeof(calibration));
+ *     ...
+ *     EEPROM.read(0x10, &calibration, sizeof(calibration));
+ *
+ * Reads see queued values at once, other reads have to wait for a running write, which is the one stall left.
+ * maxStallMicros() reports it, measured with micros(), so setupTimer() has to run for it to be right.
+ * No stall has been measured on hardware yet. From the datasheet timing, blocking writes held the caller
+ * for up to 3.4 ms per byte. Now write() does not wait at all, and a read waits at most for the cell being
+ * programmed, up to 3.4 ms once per read. The figures for a real loop have to come from maxStallMicros().
+ * Queued writes are lost on reset, flush() before going to sleep or cutting power.
+ */
+
+constexpr uintptr_t CEECR = 0x3F;
+constexpr uintptr_t CEEDR = 0x40;
+constexpr uintptr_t CEEAR = 0x41;
+constexpr uint16_t EEPROM_SIZE = 1024;
+
+struct EEPROMWrite {
+    uint16_t address;
+    uint8_t value;
+};
+
+template <uint8_t QUEUE_SIZE = 16>
+class EEPROMDriver {
+    static constexpr uint8_t CEERE = 0;
+    static constexpr uint8_t CEEPE = 1;
+    static constexpr uint8_t CEEMPE = 2;
+    static constexpr uint8_t CEERIE = 3;
+    // EEPM1:0, the default 00 erases and writes
+    static constexpr uint8_t ERASE_ONLY = 0b01 << 4;
+    static constexpr uint8_t WRITE_ONLY = 0b10 << 4;
+
+    EEPROMWrite _queue[QUEUE_SIZE] = {};
+    volatile uint8_t _head = 0;
+    volatile uint8_t _count = 0;
+    volatile uint8_t _overruns = 0;
+    volatile uint16_t _programmed = 0;
+    volatile uint16_t _skipped = 0;
+    uint16_t _last_stall_us = 0;
+    uint16_t _max_stall_us = 0;
+
+    // Only with no write running
+    static uint8_t readCell(uint16_t address) {
+        setShort(CEEAR, address);
+        setByte(CEECR, bit(CEERE));
+        return readByte(CEEDR);
+    }
+
+    // Starts programming the cell, false when it holds the value already. Interrupts have to be off
+    static bool program(uint16_t address, uint8_t value) {
+        uint8_t old = readCell(address);
+        if (old == value) return false;
+        uint8_t mode = value == 0xFF ? ERASE_ONLY : (old & value) == value ? WRITE_ONLY : 0;
+        setByte(CEEDR, value);
+        setByte(CEECR, mode | bit(CEERIE));
+        // EEPE has to follow EEMPE within 4 cycles, two sbi on the I/O address as avr-libc does it,
+        // the compiler gives no guarantee for two plain stores
+        __asm__ __volatile__(
+            "sbi %[eecr], %[eempe]\n\t"
+            "sbi %[eecr], %[eepe]\n\t"
+            :
+            : [eecr] "I"(CEECR - 0x20), [eempe] "I"(CEEMPE), [eepe] "I"(CEEPE)
+            : "memory");
+        return true;
+    }
+
+    // Newest queued value of the cell, with interrupts off
+    bool queued(uint16_t address, uint8_t& value) const {
+        for (uint8_t i = _count; i > 0; --i) {
+            const EEPROMWrite& entry = _queue[(_head + i - 1) % QUEUE_SIZE];
+            if (entry.address == address) {
+                value = entry.value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // With interrupts off, the queue has room
+    void push(uint16_t address, uint8_t value) {
+        for (uint8_t i = 0; i < _count; ++i) {
+            EEPROMWrite& entry = _queue[(_head + i) % QUEUE_SIZE];
+            if (entry.address == address) {
+                entry.value = value;
+                return;
+            }
+        }
+        _queue[(_head + _count) % QUEUE_SIZE] = EEPROMWrite{address, value};
+        _count = _count + 1;
+        // The interrupt comes right away when nothing is being programmed
+        setBit(CEECR, true, CEERIE);
+    }
+
+    void stalled(uint32_t start) {
+        uint32_t elapsed = micros() - start;
+        _last_stall_us = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+        if (_last_stall_us > _max_stall_us) {
+            _max_stall_us = _last_stall_us;
+        }
+    }
+
+   public:
+    static constexpr uint8_t CAPACITY = QUEUE_SIZE;
+
+    // Free queue entries, a write of this many bytes is accepted
+    uint8_t available() const { return QUEUE_SIZE - _count; }
+
+    // False when the queue is full, nothing is queued then
+    bool write(uint16_t address, uint8_t value) { return write(address, &value, 1); }
+
+    // All or nothing, false when the bytes do not fit into the queue
+    bool write(uint16_t address, const void* data, uint8_t length) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        InterruptLock lock;
+        if (QUEUE_SIZE - _count < length) {
+            _overruns = _overruns + 1;
+            return false;
+        }
+        for (uint8_t i = 0; i < length; ++i) {
+            push(address + i, bytes[i]);
+        }
+        return true;
+    }
+
+    uint8_t read(uint16_t address) {
+        uint32_t start = 0;
+        bool waited = false;
+        while (true) {
+            uint8_t value;
+            bool ready;
+            {
+                InterruptLock lock;
+                ready = queued(address, value);
+                if (!ready && !readBit(CEECR, CEEPE)) {
+                    value = readCell(address);
+                    ready = true;
+                }
+            }
+            if (ready) {
+                if (waited) {
+                    stalled(start);
+                }
+                return value;
+            }
+            if (!waited) {
+                waited = true;
+                start = micros();
+            }
+        }
+    }
+
+    void read(uint16_t address, void* data, uint8_t length) {
+        uint8_t* bytes = static_cast<uint8_t*>(data);
+        for (uint8_t i = 0; i < length; ++i) {
+            bytes[i] = read(address + i);
+        }
+    }
+
+    bool busy() const { return _count > 0 || readBit(CEECR, CEEPE); }
+
+    uint8_t pending() const { return _count; }
+
+    // Waits until everything queued is programmed
+    void flush() const {
+        while (busy()) {}
+    }
+
+    // Writes refused because the queue was full
+    uint8_t overruns() const { return _overruns; }
+
+    // Cells programmed and cells skipped because they held the value already
+    uint16_t programmed() const {
+        InterruptLock lock;
+        return _programmed;
+    }
+
+    uint16_t skipped() const {
+        InterruptLock lock;
+        return _skipped;
+    }
+
+    // Time read() waited for a running write, last and worst case, in microseconds
+    uint16_t lastStallMicros() const { return _last_stall_us; }
+
+    uint16_t maxStallMicros() const { return _max_stall_us; }
+
+    void resetStats() {
+        InterruptLock lock;
+        _overruns = 0;
+        _programmed = 0;
+        _skipped = 0;
+        _last_stall_us = 0;
+        _max_stall_us = 0;
+    }
+
+    // Body of the EE_READY interrupt, it keeps coming while EERIE is set and no write runs
+    void onReady() {
+        while (_count > 0) {
+            EEPROMWrite entry = _queue[_head];
+            _head = (_head + 1) % QUEUE_SIZE;
+            _count = _count - 1;
+            if (program(entry.address, entry.value)) {
+                _programmed = _programmed + 1;
+                return;
+            }
+            _skipped = _skipped + 1;
+        }
+        setByte(CEECR, 0);
+    }
+};
+
+EEPROMDriver<> EEPROM;
+
+struct EEPROMClaim : Claim<Resource::UNIT_EEPROM, Resource::VECTOR_EE_READY> {};
+
+ISR(EE_READY_vect) { EEPROM.onReady(); }
+
+/*
+ * Wear leveling for a value updated often, like an odometer, spread over SLOTS copies from START on.
+ * Every slot is the value followed by a sequence byte, an update goes to the slot after the newest one,
+ * value first and sequence last, so a reset in between leaves the previous value in place.
+ * The cells of a ring last SLOTS times as many updates. The value is kept in RAM, get() never touches the EEPROM.
+ *
+ *     EEPROMRing<uint32_t, 0x100, 32> odometer;
+ *     odometer.begin();
+ *     odometer.set(odometer.get() + distance);
+ */
+template <typename T, uint16_t START, uint8_t SLOTS>
+class EEPROMRing {
+    static constexpr uint8_t SLOT_SIZE = sizeof(T) + 1;
+    // Erased cells, the sequence skips it
+    static constexpr uint8_t EMPTY = 0xFF;
+
+    static_assert(SLOTS >= 2 && SLOTS < EMPTY, "The sequence has to break somewhere in the ring");
+    static_assert(START + static_cast<uint32_t>(SLOTS) * SLOT_SIZE <= EEPROM_SIZE, "The ring does not fit");
+    static_assert(SLOT_SIZE <= decltype(EEPROM)::CAPACITY, "A slot does not fit into the write queue");
+
+    T _value{};
+    uint8_t _head = 0;
+    uint8_t _sequence = EMPTY;
+
+    static constexpr uint16_t slotAddress(uint8_t slot) { return START + slot * SLOT_SIZE; }
+
+    static constexpr uint16_t sequenceAddress(uint8_t slot) { return slotAddress(slot) + sizeof(T); }
+
+    static uint8_t following(uint8_t sequence) { return sequence + 1 == EMPTY ? 0 : sequence + 1; }
+
+   public:
+    // Finds the newest slot, a ring which was never written holds FALLBACK
+    void begin(const T& fallback = T{}) {
+        _head = 0;
+        _sequence = EEPROM.read(sequenceAddress(0));
+        if (_sequence == EMPTY) {
+            _value = fallback;
+            return;
+        }
+        for (uint8_t i = 1; i < SLOTS; ++i) {
+            uint8_t sequence = EEPROM.read(sequenceAddress(i));
+            if (sequence != following(_sequence)) break;
+            _head = i;
+            _sequence = sequence;
+        }
+        EEPROM.read(slotAddress(_head), &_value, sizeof(T));
+    }
+
+    const T& get() const { return _value; }
+
+    // False when the write queue has no room for a slot, nothing changes then
+    bool set(const T& value) {
+        if (memcmp(&value, &_value, sizeof(T)) == 0) return true;
+        if (EEPROM.available() < SLOT_SIZE) return false;
+        uint8_t slot = _sequence == EMPTY ? 0 : (_head + 1) % SLOTS;
+        uint8_t sequence = _sequence == EMPTY ? 0 : following(_sequence);
+        EEPROM.write(slotAddress(slot), &value, sizeof(T));
+        EEPROM.write(sequenceAddress(slot), sequence);
+        _head = slot;
+        _sequence = sequence;
+        _value = value;
+        return true;
+    }
+};
+
+}  // namespace hal
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pinchange.hpp"
+#include "pins.hpp"
+
+namespace hal {
+
+/*
+ * Quadrature encoder decoded from the pin change interrupt of its port.
+ * Both phases have to share a port, so one PINx read samples them together,
+ * the old and new phase state index a 16 entry table giving the step.
+ * The interrupt runs straight through without loops, so its cost per edge is fixed.
+ *
+ *     Encoder encoder(CPD4, CPD5);
+ *     HAL_ENCODER_ISR(PCINT2_vect, encoder)
+ *
+ * or, when other pins of the port need pin change interrupts too,
+ *
+ *     HAL_PIN_CHANGE_ISR(D, OnEncoder<encoder>, OnPin<2, onButton>)
+ */
+
+// Marks a transition skipping a state, the direction is unknown
+constexpr int8_t ENCODER_INVALID = 2;
+
+// Indexed by old A, old B, new A, new B, forward is 00 -> 01 -> 11 -> 10
+constexpr int8_t ENCODER_STEPS[16] PROGMEM = {
+    0,  1,  -1, ENCODER_INVALID,
+    -1, 0,  ENCODER_INVALID, 1,
+    1,  ENCODER_INVALID, 0,  -1,
+    ENCODER_INVALID, -1, 1,  0,
+};
+
+// Not constexpr on purpose, constant initialization of an encoder on two ports fails the compilation
+void encoderPinsOnDifferentPorts();
+
+class Encoder {
+    const uintptr_t INPUT_ADDR;
+    const uint8_t MASK_A;
+    const uint8_t MASK_B;
+
+    volatile int32_t _position = 0;
+    volatile uint8_t _state = 0;
+    volatile uint8_t _errors = 0;
+    int32_t _last_position = 0;
+
+    uint8_t phases(uint8_t pins) const { return (pins & MASK_A ? 0b10 : 0) | (pins & MASK_B ? 0b01 : 0); }
+
+   public:
+    constexpr Encoder(const DigitalPin& a, const DigitalPin& b)
+        : INPUT_ADDR(a.inputAddress()), MASK_A(a.mask()), MASK_B(b.mask()) {
+        if (a.inputAddress() != b.inputAddress()) {
+            encoderPinsOnDifferentPorts();
+        }
+    }
+
+    constexpr uintptr_t inputAddress() const { return INPUT_ADDR; }
+
+    constexpr uint8_t mask() const { return MASK_A | MASK_B; }
+
+    // Inputs with the pull-ups on, most encoders have open collector outputs
+    void begin(bool pull_up = true) {
+        // DDRx and PORTx follow PINx
+        setByte(INPUT_ADDR + 1, readByte(INPUT_ADDR + 1) & ~mask());
+        uint8_t port = readByte(INPUT_ADDR + 2);
+        setByte(INPUT_ADDR + 2, pull_up ? port | mask() : port & ~mask());
+        uint8_t index = pinChangeIndex(INPUT_ADDR);
+        InterruptLock lock;
+        uint8_t pins = readByte(INPUT_ADDR);
+        _state = phases(pins);
+        pinChangeState[index] = (pinChangeState[index] & ~mask()) | (pins & mask());
+        setByte(CPCMSK0 + index, readByte(CPCMSK0 + index) | mask());
+        setBit(CPCICR, true, index);
+    }
+
+    void end() {
+        uint8_t index = pinChangeIndex(INPUT_ADDR);
+        InterruptLock lock;
+        setByte(CPCMSK0 + index, readByte(CPCMSK0 + index) & ~mask());
+    }
+
+    // Safe to call from interrupts
+    int32_t position() const {
+        InterruptLock lock;
+        return _position;
+    }
+
+    void reset(int32_t position = 0) {
+        InterruptLock lock;
+        _position = position;
+        _last_position = position;
+    }
+
+    // Steps since the last call, for control loops calling it at a fixed rate, safe to call from interrupts
+    int16_t speed() {
+        int32_t now = position();
+        int32_t delta = now - _last_position;
+        _last_position = now;
+        if (delta > INT16_MAX) return INT16_MAX;
+        if (delta < INT16_MIN) return INT16_MIN;
+        return delta;
+    }
+
+    // Transitions which skipped a state, the encoder is faster than the interrupt or bounces
+    uint8_t errors() const { return _errors; }
+
+    // Decodes an already read PINx value, for interrupts shared with other pins
+    void onPinChange(uint8_t pins) {
+        uint8_t state = phases(pins);
+        int8_t step = pgm_read_byte(&ENCODER_STEPS[(_state << 2) | state]);
+        _state = state;
+        if (step == ENCODER_INVALID) {
+            _errors = _errors + 1;
+        } else {
+            _position = _position + step;
+        }
+    }
+
+    void onInterrupt() { onPinChange(readByte(INPUT_ADDR)); }
+};
+
+// Handler for HAL_PIN_CHANGE_ISR
+template <Encoder& ENCODER>
+struct OnEncoder {
+    static void handle(uint8_t pins, uint8_t changed) {
+        if (changed & ENCODER.mask()) {
+            ENCODER.onPinChange(pins);
+        }
+    }
+};
+
+// Binds the pin change interrupt of the encoder port, PCINT0_vect for port B, PCINT1_vect for C, PCINT2_vect for D
+#define HAL_ENCODER_ISR(vector, encoder) \
+    ISR(vector) { encoder.onInterrupt(); }
+
+}  // namespace hal
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "timers.hpp"
+
+namespace hal {
+
+/*
+ * External interrupts INT0 (PD2, CPD2) and INT1 (PD3, CPD3), with their own vectors and edge selection.
+ * The entry latency on the target has not been measured.
+ *
+ *     void onEdge() { ... }
+ *     HAL_EXTERNAL_ISR(0, onEdge)
+ *
+ *     ExternalInterrupt<0>::begin(InterruptSense::FALLING);
+ */
+
+constexpr uintptr_t CEICRA = 0x69;
+constexpr uintptr_t CEIMSK = 0x3D;
+constexpr uintptr_t CEIFR = 0x3C;
+
+// Values of the ISCn1:0 bits
+enum class InterruptSense : uint8_t {
+    // Keeps firing as long as the pin is low
+    LOW_LEVEL = 0b00,
+    CHANGE = 0b01,
+    FALLING = 0b10,
+    RISING = 0b11,
+};
+
+template <uint8_t INDEX>
+class ExternalInterrupt {
+    static_assert(INDEX < 2, "ATmega328P has INT0 and INT1");
+
+   public:
+    static constexpr DigitalPin PIN = INDEX == 0 ? CPD2 : CPD3;
+
+    static void begin(InterruptSense sense, bool pull_up = false) {
+        pinMode(PIN, INPUT);
+        PIN.digitalWrite(pull_up);
+        InterruptLock lock;
+        constexpr uint8_t SHIFT = 2 * INDEX;
+        uint8_t control = readByte(CEICRA) & ~(0b11 << SHIFT);
+        setByte(CEICRA, control | (static_cast<uint8_t>(sense) << SHIFT));
+        // Changing the sense can raise the flag, an edge from before begin() is not reported
+        setByte(CEIFR, bit(INDEX));
+        setBit(CEIMSK, true, INDEX);
+    }
+
+    static void end() {
+        InterruptLock lock;
+        setBit(CEIMSK, false, INDEX);
+    }
+};
+
+template <uint8_t INDEX>
+struct ExternalInterruptClaim : Claim<INDEX == 0 ? Resource::PIN_D2 : Resource::PIN_D3,
+                                      INDEX == 0 ? Resource::VECTOR_INT0 : Resource::VECTOR_INT1> {};
+
+/*
+ * Measures the time between pulses, the timestamp is taken first thing in the interrupt.
+ * Timestamps are Timer0 ticks, 4 us at 16 MHz, so setupTimer() has to run first.
+ *
+ *     Tachometer<2> fan;
+ *     HAL_TACHOMETER_ISR(1, fan)
+ *
+ *     fan.begin<1>(InterruptSense::FALLING);
+ */
+template <uint8_t PULSES_PER_REVOLUTION = 1>
+class Tachometer {
+    static_assert(PULSES_PER_REVOLUTION > 0, "At least one pulse per revolution");
+
+    volatile uint32_t _last_edge = 0;
+    volatile uint32_t _period = 0;
+    volatile uint16_t _count = 0;
+    uint16_t _last_count = 0;
+
+   public:
+    template <uint8_t INDEX>
+    void begin(InterruptSense sense = InterruptSense::FALLING, bool pull_up = true) {
+        {
+            InterruptLock lock;
+            _period = 0;
+            _last_edge = timer0Ticks();
+        }
+        ExternalInterrupt<INDEX>::begin(sense, pull_up);
+    }
+
+    // Body of the external interrupt
+    void onEdge() {
+        uint32_t now = timer0Ticks();
+        _period = now - _last_edge;
+        _last_edge = now;
+        _count = _count + 1;
+    }
+
+    // Time between the last two pulses, 0 until two pulses were seen or after TIMEOUT_US without a pulse
+    uint32_t periodMicros(uint32_t timeout_us = 1000000) const {
+        InterruptLock lock;
+        uint32_t since = timer0Ticks() - _last_edge;
+        if (since > timeout_us / (TIMER0_TICK_NS / 1000)) return 0;
+        return _period * (TIMER0_TICK_NS / 1000);
+    }
+
+    // Revolutions per minute from the last period
+    uint32_t rpm(uint32_t timeout_us = 1000000) const {
+        uint32_t period = periodMicros(timeout_us);
+        if (period == 0) return 0;
+        return 60000000UL / PULSES_PER_REVOLUTION / period;
+    }
+
+    // Pulses since the last call, for control loops calling it at a fixed rate
+    int16_t speed() {
+        uint16_t count;
+        {
+            InterruptLock lock;
+            count = _count;
+        }
+        int16_t delta = count - _last_count;
+        _last_count = count;
+        return delta;
+    }
+};
+
+// Binds INT0 or INT1 to a function
+#define HAL_EXTERNAL_ISR(index, function) \
+    ISR(INT##index##_vect) { function(); }
+
+// Binds INT0 or INT1 to a Tachometer
+#define HAL_TACHOMETER_ISR(index, tachometer) \
+    ISR(INT##index##_vect) { tachometer.onEdge(); }
+
+}  // namespace hal
@@ -0,0 +1,594 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "concepts.hpp"
+
+namespace hal {
+
+/*
+ * FAT16 and FAT32 volumes on a block device, for reading configuration and appending logs.
+ * All files share one 512 byte sector cache in the volume, a modified sector is written back
+ * only when another sector is needed or on sync(). FAT sectors are mirrored to every FAT copy on the way out.
+ * Names are 8.3, directories in the path have to exist, files can be created in them.
+ * A card partitioned on a PC works as well as a bare file system, only the first partition is used.
+ *
+ *     FatVolume<SDCard<>> volume(card);
+ *     FatVolume<SDCard<>>::File log;
+ *     volume.mount();
+ *     volume.open(log, "LOGS/RUN.CSV", true);
+ *     log.seekEnd();
+ *     log.write("time,speed\n");
+ *     log.sync();
+ *
+ * Every file remembers a run of clusters which follow each other, walking through it needs no FAT sector.
+ * preallocate() reserves a contiguous run ahead, so a log appends without touching the FAT at all,
+ * trim() gives back what was not used before the card goes to a PC.
+ */
+
+constexpr uint16_t FAT_SECTOR_SIZE = 512;
+
+template <block_device DEVICE>
+class FatVolume {
+    static constexpr uint32_t NO_SECTOR = 0xFFFFFFFF;
+    // Normalized end of chain, FAT16 ends are converted
+    static constexpr uint32_t END = 0x0FFFFFFF;
+    static constexpr uint8_t ENTRY_SIZE = 32;
+    static constexpr uint8_t ENTRIES_PER_SECTOR = FAT_SECTOR_SIZE / ENTRY_SIZE;
+
+    // Directory entry layout
+    static constexpr uint8_t ATTRIBUTES = 11;
+    static constexpr uint8_t CLUSTER_HIGH = 20;
+    static constexpr uint8_t CLUSTER_LOW = 26;
+    static constexpr uint8_t FILE_SIZE = 28;
+    static constexpr uint8_t VOLUME_ID = 0x08;
+    static constexpr uint8_t DIRECTORY = 0x10;
+    static constexpr uint8_t ARCHIVE = 0x20;
+    static constexpr uint8_t FREE_ENTRY = 0xE5;
+
+    DEVICE& _device;
+    uint8_t _cache[FAT_SECTOR_SIZE];
+    uint32_t _cached = NO_SECTOR;
+    bool _dirty = false;
+
+    bool _fat32 = false;
+    // Sectors per cluster as a power of two
+    uint8_t _cluster_shift = 0;
+    uint8_t _fat_count = 0;
+    uint16_t _root_entries = 0;
+    uint32_t _fat_start = 0;
+    uint32_t _fat_sectors = 0;
+    // First sector of the FAT16 root directory, the root cluster on FAT32
+    uint32_t _root = 0;
+    // Sector of cluster 2
+    uint32_t _data_start = 0;
+    // One past the last cluster
+    uint32_t _cluster_end = 0;
+    uint32_t _free_hint = 2;
+    // FAT32 free cluster count which has to be invalidated before the first allocation, 0 once done
+    uint32_t _fsinfo = 0;
+
+    static uint16_t le16(const uint8_t* data) { return data[0] | (data[1] << 8); }
+
+    static uint32_t le32(const uint8_t* data) { return le16(data) | static_cast<uint32_t>(le16(data + 2)) << 16; }
+
+    static void setLe16(uint8_t* data, uint16_t val) {
+        data[0] = val;
+        data[1] = val >> 8;
+    }
+
+    static void setLe32(uint8_t* data, uint32_t val) {
+        setLe16(data, val);
+        setLe16(data + 2, val >> 16);
+    }
+
+    static bool isEnd(uint32_t cluster) { return cluster >= 0x0FFFFFF8; }
+
+    uint16_t clusterSectors() const { return 1 << _cluster_shift; }
+
+    uint32_t clusterBytes() const { return static_cast<uint32_t>(FAT_SECTOR_SIZE) << _cluster_shift; }
+
+    uint32_t clusterSector(uint32_t cluster) const { return _data_start + ((cluster - 2) << _cluster_shift); }
+
+    // The sector in the cache, MODIFY marks it for writing back, without LOAD the old content is not read
+    uint8_t* cache(uint32_t sector, bool modify, bool load = true) {
+        if (sector != _cached) {
+            if (!sync()) return nullptr;
+            if (load && !_device.readBlock(sector, _cache)) {
+                _cached = NO_SECTOR;
+                return nullptr;
+            }
+            _cached = sector;
+        }
+        _dirty = _dirty || modify;
+        return _cache;
+    }
+
+    bool fatGet(uint32_t cluster, uint32_t& next) {
+        uint32_t offset = cluster * (_fat32 ? 4 : 2);
+        uint8_t* data = cache(_fat_start + offset / FAT_SECTOR_SIZE, false);
+        if (!data) return false;
+        data += offset % FAT_SECTOR_SIZE;
+        if (_fat32) {
+            next = le32(data) & 0x0FFFFFFF;
+        } else {
+            next = le16(data);
+            if (next >= 0xFFF8) {
+                next = END;
+            }
+        }
+        return true;
+    }
+
+    bool fatSet(uint32_t cluster, uint32_t next) {
+        uint32_t offset = cluster * (_fat32 ? 4 : 2);
+        uint8_t* data = cache(_fat_start + offset / FAT_SECTOR_SIZE, true);
+        if (!data) return false;
+        data += offset % FAT_SECTOR_SIZE;
+        if (_fat32) {
+            // The upper 4 bits are reserved and keep their value
+            setLe32(data, (le32(data) & 0xF0000000) | next);
+        } else {
+            setLe16(data, next);
+        }
+        return true;
+    }
+
+    // First of COUNT free clusters in a row, 0 when there are none
+    uint32_t findFree(uint32_t count) {
+        uint32_t clusters = _cluster_end - 2;
+        uint32_t cluster = _free_hint;
+        uint32_t length = 0;
+        for (uint32_t i = 0; i < clusters; ++i, ++cluster) {
+            if (cluster >= _cluster_end) {
+                // A run does not wrap around the end
+                cluster = 2;
+                length = 0;
+            }
+            uint32_t next;
+            if (!fatGet(cluster, next)) return 0;
+            length = next == 0 ? length + 1 : 0;
+            if (length == count) return cluster + 1 - count;
+        }
+        return 0;
+    }
+
+    // Chains COUNT free contiguous clusters behind TAIL, 0 for a new chain, and returns the first one
+    uint32_t allocate(uint32_t count, uint32_t tail) {
+        if (_fsinfo) {
+            uint8_t* data = cache(_fsinfo, true);
+            if (!data) return 0;
+            // Unknown free count and next free cluster, the PC recounts
+            setLe32(data + 488, 0xFFFFFFFF);
+            setLe32(data + 492, 0xFFFFFFFF);
+            _fsinfo = 0;
+        }
+        uint32_t first = findFree(count);
+        if (!first) return 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!fatSet(first + i, i + 1 < count ? first + i + 1 : END)) return 0;
+        }
+        // The run is complete before it is linked, a failure in between only loses free clusters
+        if (tail && !fatSet(tail, first)) return 0;
+        _free_hint = first + count;
+        return first;
+    }
+
+    bool release(uint32_t cluster) {
+        while (!isEnd(cluster) && cluster >= 2) {
+            uint32_t next;
+            if (!fatGet(cluster, next) || !fatSet(cluster, 0)) return false;
+            if (cluster < _free_hint) {
+                _free_hint = cluster;
+            }
+            cluster = next;
+        }
+        return true;
+    }
+
+    uint32_t rootCluster() const { return _fat32 ? _root : 0; }
+
+    static uint32_t entryCluster(const uint8_t* entry) {
+        return static_cast<uint32_t>(le16(entry + CLUSTER_HIGH)) << 16 | le16(entry + CLUSTER_LOW);
+    }
+
+    // Next path component as a space padded 8.3 name, false when it does not fit
+    static bool shortName(const char*& path, char (&name)[11]) {
+        memset(name, ' ', sizeof(name));
+        uint8_t index = 0;
+        uint8_t end = 8;
+        for (; *path && *path != '/'; ++path) {
+            char c = *path;
+            if (c == '.' && end == 8) {
+                index = 8;
+                end = 11;
+                continue;
+            }
+            if (index == end || c == '.' || c <= ' ') return false;
+            name[index++] = c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+        }
+        return name[0] != ' ';
+    }
+
+    /*
+     * Looks through the directory starting at CLUSTER, 0 is the FAT16 root, for NAME,
+     * or for a free entry without a name, a full directory other than the FAT16 root grows by a cluster.
+     * Returns the entry inside the cache and where it lives, nullptr when there is none.
+     */
+    uint8_t* findEntry(uint32_t cluster, const char* name, uint32_t& sector, uint8_t& index) {
+        sector = cluster ? clusterSector(cluster) : _root;
+        uint16_t remaining = cluster ? clusterSectors() : _root_entries / ENTRIES_PER_SECTOR;
+        while (true) {
+            if (remaining == 0) {
+                uint32_t next;
+                if (cluster == 0 || !fatGet(cluster, next)) return nullptr;
+                if (isEnd(next)) {
+                    if (name) return nullptr;
+                    next = allocate(1, cluster);
+                    if (!next) return nullptr;
+                    for (uint16_t i = 0; i < clusterSectors(); ++i) {
+                        uint8_t* data = cache(clusterSector(next) + i, true, false);
+                        if (!data) return nullptr;
+                        memset(data, 0, FAT_SECTOR_SIZE);
+                    }
+                }
+                cluster = next;
+                sector = clusterSector(cluster);
+                remaining = clusterSectors();
+            }
+            uint8_t* data = cache(sector, false);
+            if (!data) return nullptr;
+            for (index = 0; index < ENTRIES_PER_SECTOR; ++index) {
+                uint8_t* entry = data + index * ENTRY_SIZE;
+                if (!name) {
+                    if (entry[0] == 0 || entry[0] == FREE_ENTRY) return entry;
+                } else {
+                    // Nothing is used after the first never used entry
+                    if (entry[0] == 0) return nullptr;
+                    // Long name parts carry the volume bit as well
+                    if (!(entry[ATTRIBUTES] & VOLUME_ID) && memcmp(entry, name, 11) == 0) return entry;
+                }
+            }
+            ++sector;
+            --remaining;
+        }
+    }
+
+   public:
+    class File {
+        friend class FatVolume;
+
+        FatVolume* _volume = nullptr;
+        uint32_t _entry_sector = 0;
+        uint8_t _entry_index = 0;
+        // Size or first cluster differ from the directory entry
+        bool _changed = false;
+        uint32_t _first = 0;
+        uint32_t _size = 0;
+        uint32_t _position = 0;
+        // Cluster of the byte before the position, 0 at the start
+        uint32_t _cluster = 0;
+        // Clusters known to follow each other directly
+        uint32_t _run_first = 0;
+        uint32_t _run_last = 0;
+
+        bool next(uint32_t cluster, uint32_t& res) {
+            if (cluster >= _run_first && cluster < _run_last) {
+                res = cluster + 1;
+                return true;
+            }
+            if (!_volume->fatGet(cluster, res)) return false;
+            if (res == cluster + 1) {
+                if (cluster != _run_last) {
+                    _run_first = cluster;
+                }
+                _run_last = res;
+            }
+            return true;
+        }
+
+        // Moves to the cluster holding the byte at the position, for writes the chain grows as needed
+        bool advance(bool extend) {
+            uint32_t cluster = _cluster;
+            if (_position == 0) {
+                cluster = _first;
+            } else if ((_position & (_volume->clusterBytes() - 1)) == 0) {
+                if (!next(_cluster, cluster)) return false;
+            } else {
+                return true;
+            }
+            if (cluster < 2 || isEnd(cluster)) {
+                if (!extend) return false;
+                cluster = _volume->allocate(1, _position == 0 ? 0 : _cluster);
+                if (!cluster) return false;
+                if (_position == 0) {
+                    _first = cluster;
+                    _changed = true;
+                }
+            }
+            _cluster = cluster;
+            return true;
+        }
+
+        uint32_t positionSector() const {
+            uint32_t offset = _position / FAT_SECTOR_SIZE & (_volume->clusterSectors() - 1);
+            return _volume->clusterSector(_cluster) + offset;
+        }
+
+       public:
+        bool isOpen() const { return _volume; }
+
+        uint32_t size() const { return _size; }
+
+        uint32_t position() const { return _position; }
+
+        bool available() const { return _position < _size; }
+
+        // Up to LENGTH bytes, fewer at the end of the file or on a read error
+        uint16_t read(uint8_t* data, uint16_t length) {
+            if (length > _size - _position) {
+                length = _size - _position;
+            }
+            uint16_t count = 0;
+            while (count < length) {
+                if (!advance(false)) break;
+                uint16_t offset = _position % FAT_SECTOR_SIZE;
+                uint16_t chunk = FAT_SECTOR_SIZE - offset;
+                if (chunk > length - count) {
+                    chunk = length - count;
+                }
+                uint8_t* sector = _volume->cache(positionSector(), false);
+                if (!sector) break;
+                memcpy(data + count, sector + offset, chunk);
+                _position += chunk;
+                count += chunk;
+            }
+            return count;
+        }
+
+        // Next byte, -1 at the end of the file
+        int read() {
+            uint8_t val;
+            return read(&val, 1) ? val : -1;
+        }
+
+        // Up to the end of the line or LENGTH - 1 characters, the newline is dropped, false at the end of the file
+        bool readLine(char* line, uint16_t length) {
+            uint16_t count = 0;
+            int c = read();
+            if (c < 0) return false;
+            while (c >= 0 && c != '\n') {
+                if (c != '\r' && count + 1 < length) {
+                    line[count++] = c;
+                }
+                c = read();
+            }
+            line[count] = '\0';
+            return true;
+        }
+
+        uint16_t write(const uint8_t* data, uint16_t length) {
+            uint16_t count = 0;
+            while (count < length) {
+                if (!advance(true)) break;
+                uint16_t offset = _position % FAT_SECTOR_SIZE;
+                uint16_t chunk = FAT_SECTOR_SIZE - offset;
+                if (chunk > length - count) {
+                    chunk = length - count;
+                }
+                // Sectors past the end hold nothing worth reading
+                bool fresh = offset == 0 && _position >= _size;
+                uint8_t* sector = _volume->cache(positionSector(), true, !fresh);
+                if (!sector) break;
+                if (fresh) {
+                    memset(sector, 0, FAT_SECTOR_SIZE);
+                }
+                memcpy(sector + offset, data + count, chunk);
+                _position += chunk;
+                count += chunk;
+                if (_position > _size) {
+                    _size = _position;
+                    _changed = true;
+                }
+            }
+            return count;
+        }
+
+        uint16_t write(const char* str) { return write(reinterpret_cast<const uint8_t*>(str), strlen(str)); }
+
+        // Up to the size, sequential seeks forward continue from the current cluster
+        bool seek(uint32_t position) {
+            if (position > _size) return false;
+            uint32_t shift = _volume->_cluster_shift + 9;
+            uint32_t cluster = _first;
+            uint32_t index = 0;
+            if (position == 0) {
+                cluster = 0;
+            } else if (_position > 0 && position >= _position) {
+                cluster = _cluster;
+                index = (_position - 1) >> shift;
+            }
+            uint32_t target = position == 0 ? 0 : (position - 1) >> shift;
+            for (; index < target; ++index) {
+                if (!next(cluster, cluster) || isEnd(cluster)) return false;
+            }
+            _cluster = cluster;
+            _position = position;
+            return true;
+        }
+
+        bool seekEnd() { return seek(_size); }
+
+        // Reserves contiguous clusters for SIZE bytes in total, appending up to it touches no FAT sector
+        bool preallocate(uint32_t size) {
+            uint32_t needed = (size + _volume->clusterBytes() - 1) >> (_volume->_cluster_shift + 9);
+            uint32_t last = 0;
+            uint32_t cluster = _first;
+            while (cluster >= 2 && !isEnd(cluster)) {
+                if (needed == 0) return true;
+                --needed;
+                last = cluster;
+                if (!next(cluster, cluster)) return false;
+            }
+            if (needed == 0) return true;
+            uint32_t first = _volume->allocate(needed, last);
+            if (!first) return false;
+            if (!last) {
+                _first = first;
+                _changed = true;
+            }
+            if (last + 1 != first || _run_last != last) {
+                _run_first = first;
+            }
+            _run_last = first + needed - 1;
+            return true;
+        }
+
+        // Frees the clusters past the size, left over from preallocate()
+        bool trim() {
+            uint32_t position = _position;
+            if (!seek(_size)) return false;
+            uint32_t tail = _size == 0 ? _first : 0;
+            if (_size > 0 && (!next(_cluster, tail) || !_volume->fatSet(_cluster, END))) return false;
+            if (_size == 0) {
+                _first = 0;
+                _cluster = 0;
+                _changed = true;
+            }
+            _run_first = 0;
+            _run_last = 0;
+            return _volume->release(tail) && seek(position);
+        }
+
+        // Writes the directory entry and the cached sector
+        bool sync() {
+            if (_changed) {
+                uint8_t* sector = _volume->cache(_entry_sector, true);
+                if (!sector) return false;
+                uint8_t* entry = sector + _entry_index * ENTRY_SIZE;
+                setLe16(entry + CLUSTER_HIGH, _first >> 16);
+                setLe16(entry + CLUSTER_LOW, _first);
+                setLe32(entry + FILE_SIZE, _size);
+                _changed = false;
+            }
+            return _volume->sync();
+        }
+
+        bool close() {
+            bool ok = sync();
+            _volume = nullptr;
+            return ok;
+        }
+    };
+
+    explicit FatVolume(DEVICE& device) : _device(device) {}
+
+    bool mount() {
+        _cached = NO_SECTOR;
+        _dirty = false;
+        uint8_t* data = cache(0, false);
+        if (!data) return false;
+        uint32_t start = 0;
+        // A partition table in front of the file system, boot sectors start with a jump
+        if (data[0] != 0xEB && data[0] != 0xE9) {
+            start = le32(data + 0x1C6);
+            data = cache(start, false);
+            if (!data) return false;
+        }
+        if (le16(data + 0x0B) != FAT_SECTOR_SIZE || le16(data + 0x1FE) != 0xAA55) return false;
+
+        uint8_t cluster_sectors = data[0x0D];
+        for (_cluster_shift = 0; (1 << _cluster_shift) < cluster_sectors; ++_cluster_shift) {}
+        if (cluster_sectors == 0 || (1 << _cluster_shift) != cluster_sectors) return false;
+        _fat_count = data[0x10];
+        _root_entries = le16(data + 0x11);
+        uint32_t total = le16(data + 0x13);
+        if (total == 0) {
+            total = le32(data + 0x20);
+        }
+        _fat_sectors = le16(data + 0x16);
+        if (_fat_sectors == 0) {
+            _fat_sectors = le32(data + 0x24);
+        }
+        _fat_start = start + le16(data + 0x0E);
+        _root = _fat_start + _fat_count * _fat_sectors;
+        uint32_t root_bytes = _root_entries * static_cast<uint32_t>(ENTRY_SIZE);
+        _data_start = _root + (root_bytes + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+        uint32_t clusters = (total - (_data_start - start)) >> _cluster_shift;
+        // FAT12 is for floppies
+        if (clusters < 4085) return false;
+        _fat32 = clusters >= 65525;
+        _cluster_end = clusters + 2;
+        _free_hint = 2;
+        _fsinfo = 0;
+        if (_fat32) {
+            _root = le32(data + 0x2C);
+            uint32_t fsinfo = start + le16(data + 0x30);
+            data = cache(fsinfo, false);
+            if (data && le32(data) == 0x41615252) {
+                _fsinfo = fsinfo;
+            }
+        }
+        return true;
+    }
+
+    bool isFat32() const { return _fat32; }
+
+    uint32_t clusterSize() const { return clusterBytes(); }
+
+    // Opens PATH for reading and writing at the start, with CREATE a missing file is created empty
+    bool open(File& file, const char* path, bool create = false) {
+        uint32_t directory = rootCluster();
+        char name[11];
+        uint32_t sector;
+        uint8_t index;
+        while (true) {
+            if (!shortName(path, name)) return false;
+            uint8_t* entry = findEntry(directory, name, sector, index);
+            if (*path != '/') {
+                if (entry && (entry[ATTRIBUTES] & (DIRECTORY | VOLUME_ID))) return false;
+                if (!entry) {
+                    if (!create) return false;
+                    entry = findEntry(directory, nullptr, sector, index);
+                    if (!entry) return false;
+                    memset(entry, 0, ENTRY_SIZE);
+                    memcpy(entry, name, sizeof(name));
+                    entry[ATTRIBUTES] = ARCHIVE;
+                    cache(sector, true);
+                }
+                break;
+            }
+            if (!entry || !(entry[ATTRIBUTES] & DIRECTORY)) return false;
+            // ".." of a first level directory points to cluster 0, the root
+            directory = entryCluster(entry);
+            if (directory == 0) {
+                directory = rootCluster();
+            }
+            ++path;
+        }
+        uint8_t* entry = _cache + index * ENTRY_SIZE;
+        file = File();
+        file._volume = this;
+        file._entry_sector = sector;
+        file._entry_index = index;
+        file._first = entryCluster(entry);
+        file._size = le32(entry + FILE_SIZE);
+        return true;
+    }
+
+    // Writes the cached sector back, to every FAT copy for FAT sectors
+    bool sync() {
+        if (!_dirty) return true;
+        if (!_device.writeBlock(_cached, _cache)) return false;
+        if (_cached >= _fat_start && _cached < _fat_start + _fat_sectors) {
+            for (uint8_t i = 1; i < _fat_count; ++i) {
+                if (!_device.writeBlock(_cached + i * _fat_sectors, _cache)) return false;
+            }
+        }
+        _dirty = false;
+        return true;
+    }
+};
+
+}  // namespace hal
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "concepts.hpp"
+#include "pins.hpp"
+
+namespace hal {
+
+/*
+ * Integer filters for sample streams, mostly meant for AnalogPin readings.
+ * Every filter has add(sample) which returns the new output and value() which returns the last output,
+ * so they can be chained or passed to analogRead(pin, filter).
+ * The first sample primes the filter state, so there is no ramp up from zero.
+ * tests/filters_test.cpp checks them against reference implementations on the host. Their cycle counts and
+ * flash sizes on the target have not been measured.
+ */
+
+// Moving average keeping a running sum, a sample is added and the oldest one subtracted.
+// SUM must hold N times the largest sample, uint16_t is enough for 10 bit ADC values and N <= 64.
+template <uint8_t N, unsigned_integral T = uint16_t, unsigned_integral SUM = uint32_t>
+class MovingAverage {
+    static_assert(N > 0, "Moving average needs at least one sample");
+
+    T _samples[N];
+    SUM _sum = 0;
+    uint8_t _pos = 0;
+    bool _primed = false;
+
+    void prime(T sample) {
+        for (uint8_t i = 0; i < N; ++i) {
+            _samples[i] = sample;
+        }
+        _sum = static_cast<SUM>(sample) * N;
+        _primed = true;
+    }
+
+   public:
+    T add(T sample) {
+        if (!_primed) {
+            prime(sample);
+            return sample;
+        }
+        _sum -= _samples[_pos];
+        _sum += sample;
+        _samples[_pos] = sample;
+        _pos = _pos + 1 == N ? 0 : _pos + 1;
+        return value();
+    }
+
+    // Division by a constant, a shift when N is a power of two
+    T value() const { return _sum / N; }
+
+    void reset() { _primed = false; }
+};
+
+// Exponential (single pole IIR) filter, y += (x - y) / 2^SHIFT.
+// State is kept shifted left by SHIFT bits so no precision is lost to truncation,
+// STATE must hold the largest sample shifted by SHIFT, uint16_t is enough for 10 bit ADC values and SHIFT <= 6.
+template <uint8_t SHIFT, unsigned_integral T = uint16_t, unsigned_integral STATE = uint32_t>
+class ExponentialFilter {
+    static_assert(SHIFT > 0 && SHIFT < 8 * sizeof(STATE), "Shift out of range");
+
+    static constexpr STATE HALF = static_cast<STATE>(1) << (SHIFT - 1);
+
+    STATE _state = 0;
+    bool _primed = false;
+
+   public:
+    T add(T sample) {
+        if (!_primed) {
+            _state = static_cast<STATE>(sample) << SHIFT;
+            _primed = true;
+            return sample;
+        }
+        // Rounded like value(), truncating would leave a falling input one count above the samples for good
+        _state = _state - ((_state + HALF) >> SHIFT) + sample;
+        return value();
+    }
+
+    // Rounded to the nearest integer
+    T value() const { return (_state + HALF) >> SHIFT; }
+
+    void reset() { _primed = false; }
+};
+
+// Median of the last N samples, removes spikes that averaging would smear.
+// Keeps a sorted copy of the window, a new sample replaces the oldest one and is moved into place.
+template <uint8_t N, unsigned_integral T = uint16_t>
+class MedianFilter {
+    static_assert(N % 2 == 1, "Median filter needs an odd window");
+
+    T _samples[N];
+    T _sorted[N];
+    uint8_t _pos = 0;
+    bool _primed = false;
+
+   public:
+    T add(T sample) {
+        if (!_primed) {
+            for (uint8_t i = 0; i < N; ++i) {
+                _samples[i] = sample;
+                _sorted[i] = sample;
+            }
+            _primed = true;
+            return sample;
+        }
+        T old = _samples[_pos];
+        _samples[_pos] = sample;
+        _pos = _pos + 1 == N ? 0 : _pos + 1;
+
+        // Find the oldest sample in the sorted window
+        uint8_t i = 0;
+        while (_sorted[i] != old) {
+            ++i;
+        }
+        // Slide it towards the place of the new sample
+        while (i > 0 && _sorted[i - 1] > sample) {
+            _sorted[i] = _sorted[i - 1];
+            --i;
+        }
+        while (i < N - 1 && _sorted[i + 1] < sample) {
+            _sorted[i] = _sorted[i + 1];
+            ++i;
+        }
+        _sorted[i] = sample;
+        return value();
+    }
+
+    T value() const { return _sorted[N / 2]; }
+
+    void reset() { _primed = false; }
+};
+
+// Biquad coefficients in Q2.14, a0 is normalized to 1.
+// Create them with BiquadCoefficients::from so the conversion happens at compile time.
+// Not constexpr on purpose, calling it from consteval code fails the compilation
+void biquadCoefficientOutOfRange();
+
+struct BiquadCoefficients {
+    static constexpr uint8_t FRAC_BITS = 14;
+
+    int16_t b0;
+    int16_t b1;
+    int16_t b2;
+    int16_t a1;
+    int16_t a2;
+
+    static consteval int16_t toFixed(double val) {
+        if (val >= 2.0 || val < -2.0) {
+            biquadCoefficientOutOfRange();
+        }
+        double scaled = val * (1 << FRAC_BITS);
+        return static_cast<int16_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    }
+
+    static consteval BiquadCoefficients from(double b0, double b1, double b2, double a1, double a2) {
+        return BiquadCoefficients{toFixed(b0), toFixed(b1), toFixed(b2), toFixed(a1), toFixed(a2)};
+    }
+};
+
+// Second order IIR section in direct form I,
+// y = b0 * x + b1 * x[-1] + b2 * x[-2] - a1 * y[-1] - a2 * y[-2].
+// Coefficients are template parameters, so the multiplications are by constants.
+// The sum is kept in 32 bits when the coefficients bound it there for every int16_t input, otherwise in 64 bits.
+template <BiquadCoefficients C>
+class Biquad {
+    static constexpr int64_t magnitude(int16_t coefficient) { return coefficient < 0 ? -coefficient : coefficient; }
+
+    // Every input at full scale against the sign of its coefficient, plus the rounding
+    static constexpr int64_t WORST_SUM =
+        (magnitude(C.b0) + magnitude(C.b1) + magnitude(C.b2) + magnitude(C.a1) + magnitude(C.a2)) * -INT16_MIN +
+        (1 << (BiquadCoefficients::FRAC_BITS - 1));
+    using Accumulator = typename std::conditional<(WORST_SUM <= INT32_MAX), int32_t, int64_t>::type;
+
+    int16_t _x1 = 0;
+    int16_t _x2 = 0;
+    int16_t _y1 = 0;
+    int16_t _y2 = 0;
+    bool _primed = false;
+
+    static int16_t saturate(Accumulator val) {
+        if (val > INT16_MAX) return INT16_MAX;
+        if (val < INT16_MIN) return INT16_MIN;
+        return static_cast<int16_t>(val);
+    }
+
+   public:
+    int16_t add(int16_t sample) {
+        if (!_primed) {
+            // Start as if the input had been at the first sample forever, exact for unity DC gain
+            _x1 = _x2 = sample;
+            _y1 = _y2 = sample;
+            _primed = true;
+        }
+        Accumulator acc = static_cast<Accumulator>(C.b0) * sample;
+        acc += static_cast<Accumulator>(C.b1) * _x1;
+        acc += static_cast<Accumulator>(C.b2) * _x2;
+        acc -= static_cast<Accumulator>(C.a1) * _y1;
+        acc -= static_cast<Accumulator>(C.a2) * _y2;
+        // Round to nearest
+        acc += static_cast<Accumulator>(1) << (BiquadCoefficients::FRAC_BITS - 1);
+        int16_t out = saturate(acc >> BiquadCoefficients::FRAC_BITS);
+
+        _x2 = _x1;
+        _x1 = sample;
+        _y2 = _y1;
+        _y1 = out;
+        return out;
+    }
+
+    int16_t value() const { return _y1; }
+
+    void reset() {
+        _x1 = _x2 = _y1 = _y2 = 0;
+        _primed = false;
+    }
+};
+
+// Reads the pin and feeds the sample through the filter
+auto analogRead(const analog_readable auto& pin, sample_filter auto& filter) {
+    return filter.add(analogRead(pin));
+}
+
+}  // namespace hal
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "concepts.hpp"
+
+namespace hal {
+
+/*
+ * Signed Q format fixed point numbers, Fixed<INT_BITS, FRAC_BITS> has INT_BITS integer bits (sign included)
+ * and FRAC_BITS fractional bits, together they have to fill an 8, 16 or 32 bit integer.
+ * Fixed<8, 8> covers -128 to 127.996 in steps of 1/256.
+ *
+ * Conversion from floating point literals is consteval, so no floating point code ends up in the binary.
+ * Addition, subtraction and multiplication saturate instead of wrapping around.
+ */
+
+template <uint8_t BITS>
+struct FixedStorage;
+
+// Multiplications widen into the next type, avr-gcc maps 8x8 -> 16 to a single MULS
+// and 16x16 -> 32 to __mulhisi3, both built on the hardware multiplier
+template <>
+struct FixedStorage<8> {
+    using type = int8_t;
+    using wide = int16_t;
+    static constexpr type MIN = INT8_MIN;
+    static constexpr type MAX = INT8_MAX;
+    static constexpr wide WIDE_MAX = INT16_MAX;
+};
+
+template <>
+struct FixedStorage<16> {
+    using type = int16_t;
+    using wide = int32_t;
+    static constexpr type MIN = INT16_MIN;
+    static constexpr type MAX = INT16_MAX;
+    static constexpr wide WIDE_MAX = INT32_MAX;
+};
+
+template <>
+struct FixedStorage<32> {
+    using type = int32_t;
+    using wide = int64_t;
+    static constexpr type MIN = INT32_MIN;
+    static constexpr type MAX = INT32_MAX;
+    static constexpr wide WIDE_MAX = INT64_MAX;
+};
+
+// Not constexpr on purpose, calling it from consteval code fails the compilation
+void fixedLiteralOutOfRange();
+
+template <uint8_t INT_BITS, uint8_t FRAC_BITS>
+class Fixed {
+    using Storage = FixedStorage<INT_BITS + FRAC_BITS>;
+
+   public:
+    using raw_type = typename Storage::type;
+    using wide_type = typename Storage::wide;
+
+    static constexpr uint8_t INT = INT_BITS;
+    static constexpr uint8_t FRAC = FRAC_BITS;
+    static constexpr wide_type ONE = static_cast<wide_type>(1) << FRAC_BITS;
+
+   private:
+    raw_type _raw = 0;
+
+    struct RawTag {};
+
+    constexpr Fixed(raw_type raw, RawTag) : _raw(raw) {}
+
+    static constexpr raw_type saturate(wide_type val) {
+        if (val > Storage::MAX) return Storage::MAX;
+        if (val < Storage::MIN) return Storage::MIN;
+        return static_cast<raw_type>(val);
+    }
+
+   public:
+    constexpr Fixed() = default;
+
+    // Only usable with constants, Fixed<8, 8> x = 1.5;
+    consteval Fixed(double val) {
+        double scaled = val * ONE;
+        if (scaled >= static_cast<double>(Storage::MAX) + 0.5 || scaled < static_cast<double>(Storage::MIN) - 0.5) {
+            fixedLiteralOutOfRange();
+        }
+        _raw = static_cast<raw_type>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    }
+
+    static constexpr Fixed fromRaw(raw_type raw) { return Fixed(raw, RawTag{}); }
+
+    static constexpr Fixed fromInt(integral auto val) {
+        return Fixed(saturate(static_cast<wide_type>(val) * ONE), RawTag{});
+    }
+
+    // Fraction NUM / DEN, for runtime scaling of integer readings, such as ADC counts to volts
+    static constexpr Fixed fromRatio(integral auto num, integral auto den) {
+        using Den = decltype(den);
+        if (den == 0) return Fixed(num < 0 ? Storage::MIN : Storage::MAX, RawTag{});
+        // The division stays signed, an unsigned DEN beyond wide_type only leaves a quotient that truncates to 0
+        if constexpr (static_cast<Den>(-1) > 0 && sizeof(Den) >= sizeof(wide_type)) {
+            if (den > static_cast<Den>(Storage::WIDE_MAX)) return Fixed();
+        }
+        return Fixed(saturate(static_cast<wide_type>(num) * ONE / static_cast<wide_type>(den)), RawTag{});
+    }
+
+    static constexpr Fixed max() { return Fixed(Storage::MAX, RawTag{}); }
+
+    static constexpr Fixed min() { return Fixed(Storage::MIN, RawTag{}); }
+
+    // Converts between formats, saturating when the value does not fit
+    template <uint8_t I, uint8_t F>
+    constexpr explicit Fixed(Fixed<I, F> other) {
+        using Wider = typename std::conditional<(sizeof(wide_type) > sizeof(typename Fixed<I, F>::wide_type)), wide_type,
+                                                typename Fixed<I, F>::wide_type>::type;
+        Wider val = other.raw();
+        if constexpr (F > FRAC_BITS) {
+            val >>= F - FRAC_BITS;
+        } else {
+            val <<= FRAC_BITS - F;
+        }
+        if (val > Storage::MAX) {
+            _raw = Storage::MAX;
+        } else if (val < Storage::MIN) {
+            _raw = Storage::MIN;
+        } else {
+            _raw = static_cast<raw_type>(val);
+        }
+    }
+
+    constexpr raw_type raw() const { return _raw; }
+
+    // Rounds towards negative infinity
+    constexpr raw_type toInt() const { return _raw >> FRAC_BITS; }
+
+    constexpr raw_type round() const {
+        if constexpr (FRAC_BITS == 0) {
+            return _raw;
+        } else {
+            return (static_cast<wide_type>(_raw) + (ONE >> 1)) >> FRAC_BITS;
+        }
+    }
+
+    constexpr Fixed operator+(Fixed other) const {
+        raw_type res;
+        if (__builtin_add_overflow(_raw, other._raw, &res)) {
+            res = other._raw < 0 ? Storage::MIN : Storage::MAX;
+        }
+        return Fixed(res, RawTag{});
+    }
+
+    constexpr Fixed operator-(Fixed other) const {
+        raw_type res;
+        if (__builtin_sub_overflow(_raw, other._raw, &res)) {
+            res = other._raw < 0 ? Storage::MAX : Storage::MIN;
+        }
+        return Fixed(res, RawTag{});
+    }
+
+    constexpr Fixed operator-() const { return Fixed(_raw == Storage::MIN ? Storage::MAX : -_raw, RawTag{}); }
+
+    constexpr Fixed operator*(Fixed other) const {
+        wide_type product = static_cast<wide_type>(_raw) * other._raw;
+        if constexpr (FRAC_BITS > 0) {
+            // Round to nearest
+            product += static_cast<wide_type>(1) << (FRAC_BITS - 1);
+        }
+        return Fixed(saturate(product >> FRAC_BITS), RawTag{});
+    }
+
+    // Division by zero saturates
+    constexpr Fixed operator/(Fixed other) const {
+        if (other._raw == 0) return Fixed(_raw < 0 ? Storage::MIN : Storage::MAX, RawTag{});
+        return Fixed(saturate((static_cast<wide_type>(_raw) << FRAC_BITS) / other._raw), RawTag{});
+    }
+
+    // Scaling by an integer skips the shift of a full multiplication
+    constexpr Fixed operator*(integral auto val) const {
+        return Fixed(saturate(static_cast<wide_type>(_raw) * static_cast<wide_type>(val)), RawTag{});
+    }
+
+    constexpr Fixed& operator+=(Fixed other) { return *this = *this + other; }
+
+    constexpr Fixed& operator-=(Fixed other) { return *this = *this - other; }
+
+    constexpr Fixed& operator*=(Fixed other) { return *this = *this * other; }
+
+    constexpr Fixed& operator/=(Fixed other) { return *this = *this / other; }
+
+    constexpr bool operator==(const Fixed& other) const = default;
+
+    constexpr bool operator<(Fixed other) const { return _raw < other._raw; }
+
+    constexpr bool operator>(Fixed other) const { return _raw > other._raw; }
+
+    constexpr bool operator<=(Fixed other) const { return _raw <= other._raw; }
+
+    constexpr bool operator>=(Fixed other) const { return _raw >= other._raw; }
+};
+
+using Q8_8 = Fixed<8, 8>;
+using Q1_7 = Fixed<1, 7>;
+using Q1_15 = Fixed<1, 15>;
+using Q16_16 = Fixed<16, 16>;
+
+}  // namespace hal
@@ -0,0 +1,13 @@
+#pragma once
+
+namespace hal {
+
+// Number bases of print(), shared by Serial and SoftSerial
+enum Format {
+    BIN = 2,
+    OCT = 8,
+    DEC = 10,
+    HEX = 16,
+};
+
+}  // namespace hal
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "debounce.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "ringbuf.hpp"
+
+namespace hal {
+
+/*
+ * Several buttons on one analog pin through a resistor ladder.
+ * A pull-up goes from VCC to the pin and a chain of resistors from the pin to ground,
+ * button i shorts the chain after its first i + 1 resistors to ground, so lower buttons win when several are pressed.
+ * The ADC code of every button and the thresholds half way between them are computed at compile time,
+ * a reading is decoded by a binary search over the thresholds in flash.
+ *
+ * LadderButtons keeps the table in flash, conversions are started by sample() and finished by the ADC interrupt:
+ *
+ *     hal::LadderButtons<hal::LadderTable<4>::seriesLadder(4700, {0, 1000, 2200, 4700}), hal::CADC0> keypad;
+ *     HAL_LADDER_ISR(keypad)
+ *
+ *     keypad.begin();
+ *     // every 5 to 10 ms
+ *     keypad.sample();
+ */
+
+// Not constexpr on purpose, constant initialization of a ladder the ADC cannot tell apart fails the compilation
+void ladderButtonsTooClose();
+
+template <uint8_t BUTTONS>
+class LadderTable {
+    static_assert(BUTTONS > 0 && BUTTONS < 32, "Button numbers have to fit next to the event action");
+
+    static constexpr uint16_t ADC_CODES = 1024;
+
+   public:
+    // Reading of no button pressed
+    static constexpr uint8_t NONE = BUTTONS;
+
+    // Public only so the table can be a template argument.
+    // Upper end of the window of every button, reading at or above the last one is no button
+    uint16_t thresholds[BUTTONS] = {};
+    // Readings closer than this to a threshold do not change the decoded button
+    uint8_t margin = 0;
+
+    // Ladder resistances in ohms from the pin towards ground, the first one may be 0 for a button straight to ground.
+    // Readings closer than HYSTERESIS codes to a threshold do not change the decoded button
+    static consteval LadderTable seriesLadder(uint32_t pull_up, const uint32_t (&ladder)[BUTTONS],
+                                              uint8_t hysteresis = 8) {
+        LadderTable table;
+        table.margin = hysteresis;
+        double codes[BUTTONS + 1] = {};
+        double resistance = 0.0;
+        for (uint8_t i = 0; i < BUTTONS; ++i) {
+            resistance += ladder[i];
+            codes[i] = ADC_CODES * resistance / (resistance + pull_up);
+        }
+        codes[BUTTONS] = ADC_CODES - 1;
+        for (uint8_t i = 0; i < BUTTONS; ++i) {
+            // Both neighbours keep a window wider than the hysteresis on either side
+            if (codes[i + 1] - codes[i] < 4.0 * hysteresis + 4.0) {
+                ladderButtonsTooClose();
+            }
+            table.thresholds[i] = static_cast<uint16_t>((codes[i] + codes[i + 1]) / 2.0 + 0.5);
+        }
+        return table;
+    }
+};
+
+/*
+ * Decodes and debounces the buttons of one ladder, a button counts after DEBOUNCE equal decodes in a row.
+ * Presses and releases are queued as ButtonEvents carrying the button number.
+ * Blocking analogRead() on other channels works in between, as long as it does not overlap a sample().
+ */
+template <auto TABLE, const auto& PIN, uint8_t DEBOUNCE = 4, uint8_t QUEUE_SIZE = 8>
+class LadderButtons {
+    static_assert(DEBOUNCE > 0, "Debouncing needs at least one sample");
+
+    static constexpr uint8_t BUTTONS = decltype(TABLE)::NONE;
+    // The only copy of the table
+    static constexpr decltype(TABLE) FLASH PROGMEM = TABLE;
+
+    volatile bool _pending = false;
+    volatile uint8_t _button = NONE;
+    uint8_t _candidate = NONE;
+    uint8_t _count = 0;
+    RingBuffer<QUEUE_SIZE> _events;
+
+    void push(ButtonAction action, uint8_t button) { _events.add((static_cast<uint8_t>(action) << 5) | button); }
+
+   public:
+    // Reading of no button pressed
+    static constexpr uint8_t NONE = BUTTONS;
+
+    static uint16_t threshold(uint8_t index) { return pgm_read_word(&FLASH.thresholds[index]); }
+
+    // Button of the reading, NONE when released
+    static uint8_t decode(uint16_t adc) {
+        uint8_t low = 0;
+        uint8_t high = BUTTONS;
+        while (low < high) {
+            uint8_t middle = (low + high) / 2;
+            if (adc < threshold(middle)) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        return low;
+    }
+
+    // The reading is clear of the edges of the button window by the margin
+    static bool settled(uint16_t adc, uint8_t button) {
+        uint8_t margin = pgm_read_byte(&FLASH.margin);
+        if (button > 0 && adc < threshold(button - 1) + margin) return false;
+        if (button < BUTTONS && adc + margin >= threshold(button)) return false;
+        return true;
+    }
+
+    void begin() {
+        PIN.setupAnalogRead();
+        InterruptLock lock;
+        _pending = false;
+        _button = NONE;
+        _candidate = NONE;
+        _count = 0;
+        PIN.setConversionInterrupt(true);
+    }
+
+    void end() {
+        InterruptLock lock;
+        PIN.setConversionInterrupt(false);
+        _pending = false;
+    }
+
+    // Starts a conversion, call it at a fixed rate, from a timer interrupt or the main loop
+    void sample() {
+        InterruptLock lock;
+        // The previous conversion is still running
+        if (_pending) return;
+        _pending = true;
+        PIN.startAnalogRead();
+    }
+
+    // Body of the ADC interrupt
+    void onConversion() {
+        // Conversions started by analogRead() are not ours
+        if (!_pending) return;
+        _pending = false;
+        update(PIN.analogReadResult());
+    }
+
+    // Feeds one reading, for ADC interrupts shared with other channels
+    void update(uint16_t adc) {
+        uint8_t decoded = decode(adc);
+        // Close to a threshold, the reading counts for the button seen before
+        if (decoded != _candidate && !settled(adc, decoded)) {
+            decoded = _candidate;
+        }
+        if (decoded != _candidate) {
+            _candidate = decoded;
+            _count = 1;
+        } else if (_count < DEBOUNCE) {
+            ++_count;
+        }
+        if (_count < DEBOUNCE || _candidate == _button) return;
+
+        // Sliding from one button to the next releases the first one
+        if (_button != NONE) {
+            push(ButtonAction::RELEASE, _button);
+        }
+        if (_candidate != NONE) {
+            push(ButtonAction::PRESS, _candidate);
+        }
+        _button = _candidate;
+    }
+
+    // Debounced button, NONE when released
+    uint8_t button() const { return _button; }
+
+    bool available() const {
+        InterruptLock lock;
+        return !_events.empty();
+    }
+
+    // Oldest event, NONE when there is none, the pin of the event is the button number
+    ButtonEvent read() {
+        InterruptLock lock;
+        if (_events.empty()) {
+            return ButtonEvent{ButtonAction::NONE, 0};
+        }
+        uint8_t event = _events.peek();
+        _events.remove();
+        return ButtonEvent{static_cast<ButtonAction>(event >> 5), static_cast<uint8_t>(event & 0b11111)};
+    }
+};
+
+// Blocking analogRead() still shares the converter, only the interrupt is taken
+struct LadderClaim : Claim<Resource::VECTOR_ADC> {};
+
+// Binds the ADC conversion complete interrupt to a LadderButtons instance
+#define HAL_LADDER_ISR(buttons) \
+    ISR(ADC_vect) { buttons.onConversion(); }
+
+}  // namespace hal
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "bitops.hpp"
+#include "concepts.hpp"
+#include "fixed.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "timers.hpp"
+
+namespace hal {
+
+/*
+ * DC motor control, an H-bridge driver, a slew rate limiter, a fixed point PID
+ * and a speed controller running all of them at a fixed rate from the Timer0 compare A interrupt.
+ */
+
+enum class MotorStop {
+    // Outputs floating, the motor spins down freely
+    COAST,
+    // Both motor leads shorted, the motor stops quickly
+    BRAKE,
+};
+
+// Speed is signed duty, -255 to 255
+constexpr int16_t MOTOR_MAX_DUTY = 255;
+
+/*
+ * Bridges with two direction inputs and a PWM enable, such as TB6612FNG (12_DCMOTORANYDIR) or L298N.
+ * IN1 high drives forward, IN2 high backwards, both high brakes and both low coasts.
+ * STBY is the optional standby pin of the TB6612FNG.
+ */
+template <pwm_pin PWM, io_digital_pin IN1, io_digital_pin IN2 = IN1, io_digital_pin STBY = NoPin>
+class HBridge {
+    // Empty pin types, such as Pin<PortD, 5>, take no space
+    [[no_unique_address]] const PWM _pwm;
+    [[no_unique_address]] const IN1 _in1;
+    [[no_unique_address]] const IN2 _in2;
+    [[no_unique_address]] const STBY _standby;
+
+   public:
+    constexpr HBridge(const PWM& pwm, const IN1& in1, const IN2& in2, const STBY& standby = STBY{})
+        : _pwm(pwm), _in1(in1), _in2(in2), _standby(standby) {}
+
+    void begin() const {
+        pinMode(_in1, OUTPUT);
+        pinMode(_in2, OUTPUT);
+        pinMode(_standby, OUTPUT);
+        _pwm.setupPWM();
+        stop(MotorStop::COAST);
+        _standby.digitalWrite(true);
+    }
+
+    void drive(int16_t speed) const {
+        if (speed > MOTOR_MAX_DUTY) speed = MOTOR_MAX_DUTY;
+        if (speed < -MOTOR_MAX_DUTY) speed = -MOTOR_MAX_DUTY;
+        if (speed == 0) {
+            stop(MotorStop::COAST);
+            return;
+        }
+        _in1.digitalWrite(speed > 0);
+        _in2.digitalWrite(speed < 0);
+        _pwm.setPWM(speed > 0 ? speed : -speed);
+    }
+
+    void stop(MotorStop mode) const {
+        bool brake = mode == MotorStop::BRAKE;
+        _in1.digitalWrite(brake);
+        _in2.digitalWrite(brake);
+        _pwm.setPWM(brake ? MOTOR_MAX_DUTY : 0);
+    }
+
+    // Low power mode of the bridge, no effect without a standby pin
+    void standby(bool enable) const { _standby.digitalWrite(!enable); }
+};
+
+// Controllers with a PWM input only, such as 13_SPEEDCONTROLLER, negative speeds are clamped to zero
+template <pwm_pin PWM>
+class SingleDirectionDriver {
+    [[no_unique_address]] const PWM _pwm;
+
+   public:
+    constexpr SingleDirectionDriver(const PWM& pwm) : _pwm(pwm) {}
+
+    void begin() const {
+        _pwm.setupPWM();
+        _pwm.setPWM(0);
+    }
+
+    void drive(int16_t speed) const {
+        if (speed > MOTOR_MAX_DUTY) speed = MOTOR_MAX_DUTY;
+        _pwm.setPWM(speed > 0 ? speed : 0);
+    }
+
+    void stop(MotorStop) const { _pwm.setPWM(0); }
+};
+
+// Limits how much a value changes per step, used for acceleration ramps
+class Ramp {
+    int16_t _current = 0;
+    int16_t _step;
+
+   public:
+    // Step of 0 disables the limit
+    constexpr Ramp(int16_t step = 0) : _step(step) {}
+
+    void setStep(int16_t step) { _step = step; }
+
+    int16_t next(int16_t target) {
+        int32_t diff = static_cast<int32_t>(target) - _current;
+        if (_step == 0 || (diff <= _step && -diff <= _step)) {
+            _current = target;
+        } else if (target > _current) {
+            _current += _step;
+        } else {
+            _current -= _step;
+        }
+        return _current;
+    }
+
+    int16_t value() const { return _current; }
+
+    void reset(int16_t val = 0) { _current = val; }
+};
+
+/*
+ * PID controller with Q8.8 gains, the integral and derivative gains are per call, so they include the loop period.
+ * Anti-windup stops integrating while the output saturates in the direction of the error,
+ * the derivative is taken from the measurement, so setpoint steps do not kick the output.
+ */
+class PID {
+    Q8_8 _kp;
+    Q8_8 _ki;
+    Q8_8 _kd;
+    int16_t _min;
+    int16_t _max;
+    // Scaled by Q8_8::ONE like the gains
+    int32_t _integral = 0;
+    int16_t _last_measurement = 0;
+    bool _primed = false;
+
+    static int32_t clamp(int32_t val, int32_t low, int32_t high) {
+        if (val < low) return low;
+        if (val > high) return high;
+        return val;
+    }
+
+   public:
+    constexpr PID(Q8_8 kp, Q8_8 ki, Q8_8 kd, int16_t min = -MOTOR_MAX_DUTY, int16_t max = MOTOR_MAX_DUTY)
+        : _kp(kp), _ki(ki), _kd(kd), _min(min), _max(max) {}
+
+    void setGains(Q8_8 kp, Q8_8 ki, Q8_8 kd) {
+        _kp = kp;
+        _ki = ki;
+        _kd = kd;
+    }
+
+    int16_t update(int16_t setpoint, int16_t measurement) {
+        if (!_primed) {
+            _last_measurement = measurement;
+            _primed = true;
+        }
+        int32_t error = clamp(static_cast<int32_t>(setpoint) - measurement, INT16_MIN, INT16_MAX);
+        int32_t low = static_cast<int32_t>(_min) * Q8_8::ONE;
+        int32_t high = static_cast<int32_t>(_max) * Q8_8::ONE;
+
+        int32_t proportional = _kp.raw() * error;
+        int32_t change = clamp(static_cast<int32_t>(_last_measurement) - measurement, INT16_MIN, INT16_MAX);
+        int32_t derivative = _kd.raw() * change;
+        _last_measurement = measurement;
+
+        int32_t integral = clamp(_integral + _ki.raw() * error, low, high);
+        int32_t output = proportional + integral + derivative;
+        // Integrate only when it does not push the output further into saturation
+        if (!(output > high && error > 0) && !(output < low && error < 0)) {
+            _integral = integral;
+        }
+        output = proportional + _integral + derivative;
+        return clamp(output, low, high) / Q8_8::ONE;
+    }
+
+    void reset() {
+        _integral = 0;
+        _primed = false;
+    }
+};
+
+constexpr uint8_t COCIE0A = 1;
+// Timer0 runs at clock / 64 after setupTimer(), execution times are measured in its ticks
+constexpr uint16_t CONTROL_TIMER_TICK_US = 64 * 1000000UL / F_CPU;
+
+/*
+ * Closed loop speed control, feedback is read once per loop as counts per loop period.
+ * The loop runs every DIVIDER Timer0 periods, 976.5625 / DIVIDER Hz with the default setupTimer(),
+ * the setpoint goes through an acceleration ramp first.
+ * maxLoopMicros() reports the execution time of the loop on the target, no figure has been measured yet.
+ *
+ *     constexpr auto motor = HBridge(CPB2PWM<>, CPB4, CPB5, CPB3);
+ *     SpeedController<decltype(motor), decltype(tachometer)> controller(motor, tachometer, PID(2.0, 0.5, 0.0));
+ *     HAL_CONTROL_LOOP_ISR(controller)
+ */
+template <typename MOTOR, speed_feedback FEEDBACK, uint8_t DIVIDER = 10>
+class SpeedController {
+    static_assert(DIVIDER > 0, "Divider has to be at least 1");
+
+    const MOTOR& _motor;
+    FEEDBACK& _feedback;
+    PID _pid;
+    Ramp _ramp;
+    volatile int16_t _setpoint = 0;
+    volatile int16_t _speed = 0;
+    volatile int16_t _output = 0;
+    volatile bool _running = false;
+    uint8_t _ticks = 0;
+    volatile uint8_t _last_loop_ticks = 0;
+    volatile uint8_t _max_loop_ticks = 0;
+
+   public:
+    SpeedController(const MOTOR& motor, FEEDBACK& feedback, const PID& pid, int16_t acceleration = 0)
+        : _motor(motor), _feedback(feedback), _pid(pid), _ramp(acceleration) {}
+
+    void begin() {
+        _motor.begin();
+        cli();
+        _pid.reset();
+        _ramp.reset();
+        _running = true;
+        setBit(CTIMSK0, true, COCIE0A);
+        sei();
+    }
+
+    void end(MotorStop mode = MotorStop::BRAKE) {
+        cli();
+        _running = false;
+        setBit(CTIMSK0, false, COCIE0A);
+        sei();
+        _motor.stop(mode);
+    }
+
+    void setSpeed(int16_t speed) {
+        cli();
+        _setpoint = speed;
+        sei();
+    }
+
+    // Setpoint change per loop, 0 disables the ramp
+    void setAcceleration(int16_t step) {
+        cli();
+        _ramp.setStep(step);
+        sei();
+    }
+
+    // Last measured speed
+    int16_t speed() const {
+        cli();
+        int16_t res = _speed;
+        sei();
+        return res;
+    }
+
+    int16_t output() const {
+        cli();
+        int16_t res = _output;
+        sei();
+        return res;
+    }
+
+    // Execution time of the control loop, last and worst one, in microseconds
+    uint16_t lastLoopMicros() const { return _last_loop_ticks * CONTROL_TIMER_TICK_US; }
+
+    uint16_t maxLoopMicros() const { return _max_loop_ticks * CONTROL_TIMER_TICK_US; }
+
+    void resetLoopStats() { _max_loop_ticks = 0; }
+
+    // Body of the Timer0 compare A interrupt
+    void tick() {
+        if (++_ticks < DIVIDER) return;
+        _ticks = 0;
+        if (!_running) return;
+
+        uint8_t start = readByte(CTCNT0);
+        int16_t speed = _feedback.speed();
+        int16_t output = _pid.update(_ramp.next(_setpoint), speed);
+        _motor.drive(output);
+        _speed = speed;
+        _output = output;
+
+        // Counter wraps every 256 ticks, one Timer0 period, a loop running longer would read short
+        uint8_t elapsed = readByte(CTCNT0) - start;
+        _last_loop_ticks = elapsed;
+        if (elapsed > _max_loop_ticks) {
+            _max_loop_ticks = elapsed;
+        }
+    }
+};
+
+// Timer0 itself belongs to the time base, the loop only adds its compare interrupt
+struct ControlLoopClaim : Claim<Resource::VECTOR_TIMER0_COMPA> {};
+
+// Binds the Timer0 compare A interrupt to a SpeedController instance
+#define HAL_CONTROL_LOOP_ISR(controller) \
+    ISR(TIMER0_COMPA_vect) { controller.tick(); }
+
+}  // namespace hal
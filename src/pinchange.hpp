@@ -0,0 +1,109 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+
+namespace hal {
+
+/*
+ * Pin change interrupts PCINT0 (port B), PCINT1 (port C) and PCINT2 (port D).
+ * The interrupt keeps the last port state, XORs it with the new one and calls the handlers of the changed pins.
+ * Handlers are template parameters of the interrupt, so the calls are direct and there is no table in RAM.
+ *
+ *     void onButton(bool level) { ... }
+ *     HAL_PIN_CHANGE_ISR(D, OnPin<2, onButton, PinEdge::FALLING>, OnPin<7, onOther>)
+ *
+ *     enablePinChange(CPD2);
+ */
+
+constexpr uintptr_t CPCICR = 0x68;
+constexpr uintptr_t CPCMSK0 = 0x6B;
+
+// Index of the pin change interrupt serving the port, PINB, PINC and PIND are 3 addresses apart.
+// After the avr headers PINB is the macro, CPB0 gives the address
+constexpr uint8_t pinChangeIndex(uintptr_t input_addr) { return (input_addr - CPB0.inputAddress()) / 3; }
+
+// Port states seen by the last interrupt, indexed like the interrupts
+inline volatile uint8_t pinChangeState[3] = {};
+
+void enablePinChange(const DigitalPin& pin) {
+    uint8_t index = pinChangeIndex(pin.inputAddress());
+    InterruptLock lock;
+    // Start from the current level, so enabling does not report a change
+    uint8_t state = pinChangeState[index] & ~pin.mask();
+    pinChangeState[index] = state | (readByte(pin.inputAddress()) & pin.mask());
+    setByte(CPCMSK0 + index, readByte(CPCMSK0 + index) | pin.mask());
+    setBit(CPCICR, true, index);
+}
+
+// The interrupt of the port stays on, other pins may use it
+void disablePinChange(const DigitalPin& pin) {
+    uint8_t index = pinChangeIndex(pin.inputAddress());
+    InterruptLock lock;
+    setByte(CPCMSK0 + index, readByte(CPCMSK0 + index) & ~pin.mask());
+}
+
+enum class PinEdge {
+    ANY,
+    RISING,
+    FALLING,
+};
+
+// Calls CALLBACK with the new level whenever pin BIT of the port changes
+template <uint8_t BIT, void (*CALLBACK)(bool), PinEdge EDGE = PinEdge::ANY>
+struct OnPin {
+    static_assert(BIT < 8, "Ports have 8 pins");
+
+    static void handle(uint8_t pins, uint8_t changed) {
+        constexpr uint8_t MASK = 1 << BIT;
+        if (!(changed & MASK)) return;
+        bool level = pins & MASK;
+        if (EDGE == PinEdge::RISING && !level) return;
+        if (EDGE == PinEdge::FALLING && level) return;
+        CALLBACK(level);
+    }
+};
+
+// Calls CALLBACK with the whole port value whenever any pin in MASK changes
+template <uint8_t MASK, void (*CALLBACK)(uint8_t)>
+struct OnPins {
+    static void handle(uint8_t pins, uint8_t changed) {
+        if (changed & MASK) {
+            CALLBACK(pins);
+        }
+    }
+};
+
+template <uintptr_t INPUT_ADDR, typename... HANDLERS>
+void dispatchPinChange() {
+    constexpr uint8_t INDEX = pinChangeIndex(INPUT_ADDR);
+    uint8_t pins = readByte(INPUT_ADDR);
+    // Pins outside the mask may have changed as well, they are not ours to report
+    uint8_t changed = (pins ^ pinChangeState[INDEX]) & readByte(CPCMSK0 + INDEX);
+    pinChangeState[INDEX] = pins;
+    (HANDLERS::handle(pins, changed), ...);
+}
+
+#define HAL_PCINT_VECTOR_B PCINT0_vect
+#define HAL_PCINT_VECTOR_C PCINT1_vect
+#define HAL_PCINT_VECTOR_D PCINT2_vect
+// A pin of the port, for the PINx address, PINB itself is the avr-libc macro
+#define HAL_PCINT_PIN_B hal::CPB0
+#define HAL_PCINT_PIN_C hal::CPC0
+#define HAL_PCINT_PIN_D hal::CPD0
+
+// Vector of the port of PIN, PinChangeClaim<CPD2>, the pins are claimed separately
+template <const auto& PIN>
+struct PinChangeClaim : Claim<static_cast<Resource>(static_cast<uint8_t>(Resource::VECTOR_PCINT0) +
+                                                    pinChangeIndex(PIN.inputAddress()))> {};
+
+// Binds the pin change interrupt of port B, C or D to its handlers
+#define HAL_PIN_CHANGE_ISR(port, ...) \
+    ISR(HAL_PCINT_VECTOR_##port) { hal::dispatchPinChange<HAL_PCINT_PIN_##port.inputAddress(), __VA_ARGS__>(); }
+
+}  // namespace hal
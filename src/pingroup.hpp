@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+
+namespace hal {
+
+/*
+ * Several pins of one port changed or read together in a single port access, without intermediate states.
+ * Values are packed in the order of the pins, bit 0 of a value belongs to the first pin.
+ *
+ *     PinGroup<CPD4, CPD5, CPD6, CPD7> lcd_data;
+ *     lcd_data.setOutputMode();
+ *     lcd_data.write(nibble);
+ */
+template <const auto& FIRST, const auto&... REST>
+class PinGroup {
+    static constexpr uint8_t COUNT = 1 + sizeof...(REST);
+    static constexpr uintptr_t INPUT_ADDR = FIRST.inputAddress();
+    static constexpr uintptr_t MODE_ADDR = FIRST.modeAddress();
+    static constexpr uintptr_t OUTPUT_ADDR = FIRST.outputAddress();
+    static constexpr uint8_t POSITIONS[COUNT] = {FIRST.position(), REST.position()...};
+
+    static constexpr bool distinct() {
+        uint8_t seen = 0;
+        for (uint8_t pos : POSITIONS) {
+            if (seen & (1 << pos)) return false;
+            seen |= 1 << pos;
+        }
+        return true;
+    }
+
+    // Pins in ascending order without gaps pack by a single shift
+    static constexpr bool contiguous() {
+        for (uint8_t i = 1; i < COUNT; ++i) {
+            if (POSITIONS[i] != POSITIONS[0] + i) return false;
+        }
+        return true;
+    }
+
+    static_assert(((REST.inputAddress() == INPUT_ADDR) && ...), "Pins of a group have to share a port");
+    static_assert(distinct(), "Pins of a group have to differ");
+
+   public:
+    static constexpr uint8_t MASK = (FIRST.mask() | ... | REST.mask());
+
+    // Packed value to the bits of the port
+    static constexpr uint8_t toPort(uint8_t value) {
+        if constexpr (contiguous()) {
+            return (value << POSITIONS[0]) & MASK;
+        } else {
+            uint8_t bits = 0;
+            for (uint8_t i = 0; i < COUNT; ++i) {
+                if (value & (1 << i)) bits |= 1 << POSITIONS[i];
+            }
+            return bits;
+        }
+    }
+
+    // Bits of the port to a packed value
+    static constexpr uint8_t fromPort(uint8_t bits) {
+        if constexpr (contiguous()) {
+            return (bits & MASK) >> POSITIONS[0];
+        } else {
+            uint8_t value = 0;
+            for (uint8_t i = 0; i < COUNT; ++i) {
+                if (bits & (1 << POSITIONS[i])) value |= 1 << i;
+            }
+            return value;
+        }
+    }
+
+    void setOutputMode() const {
+        InterruptLock lock;
+        setByte(MODE_ADDR, readByte(MODE_ADDR) | MASK);
+    }
+
+    // Pull-ups follow the last written value
+    void setInputMode() const {
+        InterruptLock lock;
+        setByte(MODE_ADDR, readByte(MODE_ADDR) & ~MASK);
+    }
+
+    void write(uint8_t value) const { writePort(toPort(value)); }
+
+    // Already positioned bits, other bits of the port are left alone
+    void writePort(uint8_t bits) const {
+        InterruptLock lock;
+        setByte(OUTPUT_ADDR, (readByte(OUTPUT_ADDR) & ~MASK) | (bits & MASK));
+    }
+
+    uint8_t read() const { return fromPort(readByte(INPUT_ADDR)); }
+
+    // Writing ones to PINx toggles PORTx, a single write without reading the port first
+    void toggle(uint8_t value) const { setByte(INPUT_ADDR, toPort(value)); }
+
+    void toggle() const { setByte(INPUT_ADDR, MASK); }
+};
+
+}  // namespace hal
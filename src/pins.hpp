@@ -45,6 +45,13 @@ class DigitalPin {
         static_assert(io_digital_pin<DigitalPin>);
     }
 
+    // Register addresses for drivers, which work on whole ports
+    constexpr uintptr_t modeAddress() const { return PIN_MODE_ADDR; }
+    constexpr uintptr_t outputAddress() const { return PIN_OUTPUT_ADDR; }
+    constexpr uintptr_t inputAddress() const { return PIN_INPUT_ADDR; }
+    constexpr uint8_t position() const { return PIN_POS; }
+    constexpr uint8_t mask() const { return 1 << PIN_POS; }
+
     inline void digitalWrite(bool val) const { setBit(PIN_OUTPUT_ADDR, val, PIN_POS); }
 
     inline bool digitalRead() const { return readBit(PIN_INPUT_ADDR, PIN_POS); }
@@ -76,6 +83,14 @@ void pinMode(const io_digital_pin auto& pin, bool mode) {
     }
 }
 
+// Stands in for optional pins, does nothing
+struct NoPin {
+    constexpr void digitalWrite(bool) const {}
+    constexpr bool digitalRead() const { return false; }
+    constexpr void setInputMode() const {}
+    constexpr void setOutputMode() const {}
+};
+
 enum {
     LOW = 0,
     HIGH = 1,
@@ -85,45 +100,177 @@ void digitalWrite(const digital_writeable auto& pin, bool val) { pin.digitalWrit
 
 bool digitalRead(const digital_readable auto& pin) { return pin.digitalRead(); }
 
+enum class PWMMode {
+    FAST,
+    PHASE_CORRECT,
+};
+
+/*
+ * PWM on the 8 bit timers, PRESCALE are the raw CSx2:0 bits.
+ * Timer0 and Timer2 decode them differently, 0b011 is clock / 64 on Timer0 but clock / 32 on Timer2,
+ * Timer0 also drives millis(), so changing its prescaler changes the time base.
+ * Fast PWM runs at F_CPU / (N * 256), phase correct at half of that.
+ */
+template <uint8_t PRESCALE = 0b011, PWMMode MODE = PWMMode::FAST>
 class PWMPin : public DigitalPin {
+    static_assert(PRESCALE > 0 && PRESCALE <= 0b111, "Prescaler bits out of range");
+
+    template <uint8_t, PWMMode>
+    friend class PWMPin;
+
     const uintptr_t COMPARE_REG_ADDR;
     const uintptr_t COUNTER_CTRL_ADDR;
     const uintptr_t PRESCALE_ADDR;
+    // COMxA1 or COMxB1, depending on the channel
+    const uint8_t COM_POS;
+
+    constexpr PWMPin(const DigitalPin& pin, uintptr_t compare_reg, uintptr_t ctrl_addr, uintptr_t prescale_addr,
+                     uint8_t com_pos)
+        : DigitalPin(pin),
+          COMPARE_REG_ADDR(compare_reg),
+          COUNTER_CTRL_ADDR(ctrl_addr),
+          PRESCALE_ADDR(prescale_addr),
+          COM_POS(com_pos) {}
 
    public:
     constexpr PWMPin(uintptr_t mode_addr, uintptr_t output_addr, uintptr_t input_addr, unsigned char pin_pos,
-                     uintptr_t compare_reg, uintptr_t ctrl_addr, uintptr_t prescale_addr)
+                     uintptr_t compare_reg, uintptr_t ctrl_addr, uintptr_t prescale_addr, uint8_t com_pos)
         : DigitalPin(mode_addr, output_addr, input_addr, pin_pos),
           COMPARE_REG_ADDR(compare_reg),
           COUNTER_CTRL_ADDR(ctrl_addr),
-          PRESCALE_ADDR(prescale_addr) {
+          PRESCALE_ADDR(prescale_addr),
+          COM_POS(com_pos) {
               static_assert(pwm_pin<PWMPin>);
         }
+
+        // Same pin with different timer settings, CPD3.with<0b001, PWMMode::PHASE_CORRECT>()
+        template <uint8_t NEW_PRESCALE, PWMMode NEW_MODE = MODE>
+        constexpr PWMPin<NEW_PRESCALE, NEW_MODE> with() const {
+            return PWMPin<NEW_PRESCALE, NEW_MODE>(*this, COMPARE_REG_ADDR, COUNTER_CTRL_ADDR, PRESCALE_ADDR, COM_POS);
+        }
         
         void setupPWM() const {
             setOutputMode();
-            // Setting Fast PWM
+            // Fast PWM is WGMx1:0 = 11, phase correct PWM is 01
             const auto WGMx0 = 0;
             setBit(COUNTER_CTRL_ADDR, true, WGMx0);
             const auto WGMx1 = 1;
-            setBit(COUNTER_CTRL_ADDR, true, WGMx1);
+            setBit(COUNTER_CTRL_ADDR, MODE == PWMMode::FAST, WGMx1);
             // Non-inverting mode
-            const auto COMxA1 = 7;
-            setBit(COUNTER_CTRL_ADDR, true, COMxA1);
-            // Set the prescaler from disabled to Clock / 64
-            const auto CSx0 = 0;
-            setBit(PRESCALE_ADDR, true, CSx0);
-            const auto CSx1 = 1;
-            setBit(PRESCALE_ADDR, true, CSx1);
+            setBit(COUNTER_CTRL_ADDR, true, COM_POS);
+            // Replace the clock select bits, WGMx2 stays cleared so the top is 0xFF
+            const uint8_t CS_MASK = 0b111;
+            const uint8_t WGMx2 = 3;
+            const uint8_t keep = readByte(PRESCALE_ADDR) & ~(CS_MASK | bit(WGMx2));
+            setByte(PRESCALE_ADDR, keep | PRESCALE);
         }
         
         void setPWM(uint8_t val) const {
             setByte(COMPARE_REG_ADDR, val);
         }
+
+        bool isPWMEnabled() const { return readBit(COUNTER_CTRL_ADDR, COM_POS); }
+
+        // Timer registers of the channel, for the Pin types of portpin.hpp
+        constexpr uintptr_t compareAddress() const { return COMPARE_REG_ADDR; }
+        constexpr uintptr_t controlAddress() const { return COUNTER_CTRL_ADDR; }
+        constexpr uintptr_t prescaleAddress() const { return PRESCALE_ADDR; }
+        constexpr uint8_t comPosition() const { return COM_POS; }
+};
+
+constexpr uintptr_t CTCCR1A = 0x80;
+constexpr uintptr_t CTCCR1B = 0x81;
+constexpr uintptr_t CTCNT1 = 0x84;
+constexpr uintptr_t CICR1 = 0x86;
+constexpr uintptr_t COCR1A = 0x88;
+constexpr uintptr_t COCR1B = 0x8A;
+constexpr uintptr_t CTIMSK1 = 0x6F;
+
+// Smallest Timer1 prescaler, which still fits the period into 16 bits, the smaller the prescaler the finer the duty
+struct Timer1Clock {
+    uint16_t divider;
+    uint8_t cs_bits;
+    uint16_t top;
+
+    template <uint32_t FREQUENCY, PWMMode MODE>
+    static consteval Timer1Clock forFrequency() {
+        // Above F_CPU / 2 the period is shorter than two ticks and TOP underflows
+        static_assert(FREQUENCY > 0 && FREQUENCY <= F_CPU / 2, "Timer1 frequency out of range");
+        constexpr uint16_t DIVIDERS[] = {1, 8, 64, 256, 1024};
+        for (uint8_t i = 0; i < 5; ++i) {
+            // Fast PWM counts 0..TOP, phase correct counts up to TOP and back down
+            uint32_t ticks = F_CPU / DIVIDERS[i] / FREQUENCY;
+            uint32_t top = MODE == PWMMode::FAST ? ticks - 1 : ticks / 2;
+            if (top <= 0xFFFF) {
+                return Timer1Clock{DIVIDERS[i], static_cast<uint8_t>(i + 1), static_cast<uint16_t>(top)};
+            }
+        }
+        return Timer1Clock{1024, 0b101, 0xFFFF};
+    }
+};
+
+/*
+ * PWM on the 16 bit Timer1, OC1A (PB1) and OC1B (PB2).
+ * The period is set by ICR1 (mode 14 for fast PWM, mode 10 for phase correct), so the frequency is arbitrary,
+ * the resolution is whatever fits into the period, TOP + 1 steps, 800 at 20 kHz and 65536 below 245 Hz.
+ * Both channels share ICR1 and the prescaler, use the same FREQUENCY and MODE for both.
+ */
+template <uint32_t FREQUENCY = 20000, PWMMode MODE = PWMMode::FAST>
+class Timer1PWMPin : public DigitalPin {
+    static constexpr Timer1Clock CLOCK = Timer1Clock::forFrequency<FREQUENCY, MODE>();
+    static_assert(CLOCK.top >= 3, "Frequency too high for at least 2 bits of resolution");
+
+    const uintptr_t COMPARE_REG_ADDR;
+    const uint8_t COM_POS;
+
+   public:
+    static constexpr uint16_t TOP = CLOCK.top;
+
+    constexpr Timer1PWMPin(uintptr_t mode_addr, uintptr_t output_addr, uintptr_t input_addr, unsigned char pin_pos,
+                           uintptr_t compare_reg, uint8_t com_pos)
+        : DigitalPin(mode_addr, output_addr, input_addr, pin_pos), COMPARE_REG_ADDR(compare_reg), COM_POS(com_pos) {
+        static_assert(pwm_pin<Timer1PWMPin>);
+    }
+
+    void setupPWM() const {
+        setOutputMode();
+        setShort(CICR1, TOP);
+        // Non-inverting mode, COM1x1:0 = 10
+        setBit(CTCCR1A, true, COM_POS);
+        // WGM13:10 is 1110 for fast PWM and 1010 for phase correct, both with ICR1 as top
+        const uint8_t WGM10 = 0;
+        const uint8_t WGM11 = 1;
+        setBit(CTCCR1A, false, WGM10);
+        setBit(CTCCR1A, true, WGM11);
+        const uint8_t WGM12 = 3;
+        const uint8_t WGM13 = 4;
+        uint8_t ctrl = bit(WGM13) | CLOCK.cs_bits;
+        if (MODE == PWMMode::FAST) {
+            ctrl |= bit(WGM12);
+        }
+        setByte(CTCCR1B, ctrl);
+    }
+
+    // Hands the pin back to PORTB, where it stays low
+    void disconnect() const {
+        setBit(CTCCR1A, false, COM_POS);
+        digitalWrite(false);
+    }
+
+    bool isPWMEnabled() const { return readBit(CTCCR1A, COM_POS); }
+
+    // Full resolution duty, 0 to TOP
+    void setDuty(uint16_t val) const { setShort(COMPARE_REG_ADDR, val > TOP ? TOP : val); }
+
+    // 8 bit duty scaled to the period, so the pin can stand in for the 8 bit PWMPin
+    void setPWM(uint8_t val) const { setDuty((static_cast<uint32_t>(val) * TOP + 127) / 255); }
 };
 
 void analogWrite(const pwm_pin auto& pin, uint8_t val) {
-    pin.setupPWM();
+    // Setting the timer up again would restart the prescaler on every write
+    if (!pin.isPWMEnabled()) {
+        pin.setupPWM();
+    }
     pin.setPWM(val);
 }
 
@@ -134,6 +281,9 @@ class AnalogPin {
     const uintptr_t ADMUX = 0x7C;
     const uint8_t REFS0 = 6;
     const uintptr_t ADCSRA = 0x7A;
+    const uint8_t ADSC = 6;
+    const uint8_t ADIE = 3;
+    const uintptr_t ADCSHORT = 0x78;
     
 public:
     constexpr AnalogPin(uint8_t mask) : MASK(mask) {
@@ -146,18 +296,29 @@ public:
         
         const uint8_t ADEN = 7;
         const uint8_t prescale = PRESCALE | (1 << ADEN);
-        setByte(ADCSRA, prescale);
+        // Keeps ADIE, so a blocking read does not switch off the conversion interrupt of LadderButtons
+        setByte(ADCSRA, prescale | (readByte(ADCSRA) & (1 << ADIE)));
     }
     
     uint16_t analogRead() const {
+        startAnalogRead();
+        while (!analogReadDone());
+        return analogReadResult();
+    }
+
+    // Starts a conversion and returns right away, the result is there once analogReadDone()
+    void startAnalogRead() const {
         const uint8_t mask = MASK | (1 << REFS0);
         setByte(ADMUX, mask);
-        const uint8_t ADSC = 6;
         setBit(ADCSRA, true, ADSC);
-        while (readBit(ADCSRA, ADSC));
-        const uintptr_t ADCSHORT = 0x78;
-        return readShort(ADCSHORT);
     }
+
+    bool analogReadDone() const { return !readBit(ADCSRA, ADSC); }
+
+    uint16_t analogReadResult() const { return readShort(ADCSHORT); }
+
+    // ADC_vect fires after every conversion, on any channel
+    void setConversionInterrupt(bool enable) const { setBit(ADCSRA, enable, ADIE); }
 };
 
 uint16_t analogRead(const analog_readable auto& pin) {
@@ -171,10 +332,15 @@ constexpr uintptr_t PINB = 0x23;
 constexpr auto CPB0 = DigitalPin(DDRB, PORTB, PINB, 0);
 constexpr auto CPB1 = DigitalPin(DDRB, PORTB, PINB, 1);
 constexpr auto CPB2 = DigitalPin(DDRB, PORTB, PINB, 2);
+// The same pins as OC1A and OC1B, CPB1PWM<> runs at 20 kHz
+template <uint32_t FREQUENCY = 20000, PWMMode MODE = PWMMode::FAST>
+constexpr auto CPB1PWM = Timer1PWMPin<FREQUENCY, MODE>(DDRB, PORTB, PINB, 1, COCR1A, 7);
+template <uint32_t FREQUENCY = 20000, PWMMode MODE = PWMMode::FAST>
+constexpr auto CPB2PWM = Timer1PWMPin<FREQUENCY, MODE>(DDRB, PORTB, PINB, 2, COCR1B, 5);
 constexpr uintptr_t OCR2A = 0xB3;
 constexpr uintptr_t TCCR2A = 0xB0;
 constexpr uintptr_t TCCR2B = 0xB1;
-constexpr auto CPB3 = PWMPin(DDRB, PORTB, PINB, 3, OCR2A, TCCR2A, TCCR2B);
+constexpr auto CPB3 = PWMPin(DDRB, PORTB, PINB, 3, OCR2A, TCCR2A, TCCR2B, 7);
 constexpr auto CPB4 = DigitalPin(DDRB, PORTB, PINB, 4);
 constexpr auto CPB5 = DigitalPin(DDRB, PORTB, PINB, 5);
 constexpr auto CPB6 = DigitalPin(DDRB, PORTB, PINB, 6);
@@ -198,14 +364,14 @@ constexpr auto CPD0 = DigitalPin(DDRD, PORTD, PIND, 0);
 constexpr auto CPD1 = DigitalPin(DDRD, PORTD, PIND, 1);
 constexpr auto CPD2 = DigitalPin(DDRD, PORTD, PIND, 2);
 constexpr uintptr_t OCR2B = 0xB4;
-constexpr auto CPD3 = PWMPin(DDRD, PORTD, PIND, 3, OCR2B, TCCR2A, TCCR2B);
+constexpr auto CPD3 = PWMPin(DDRD, PORTD, PIND, 3, OCR2B, TCCR2A, TCCR2B, 5);
 constexpr auto CPD4 = DigitalPin(DDRD, PORTD, PIND, 4);
 constexpr uintptr_t OCR0B = 0x48;
 constexpr uintptr_t TCCR0A = 0x44;
 constexpr uintptr_t TCCR0B = 0x45;
-constexpr auto CPD5 = PWMPin(DDRD, PORTD, PIND, 5, OCR0B, TCCR0A, TCCR0B);
+constexpr auto CPD5 = PWMPin(DDRD, PORTD, PIND, 5, OCR0B, TCCR0A, TCCR0B, 5);
 constexpr uintptr_t OCR0A = 0x47;
-constexpr auto CPD6 = PWMPin(DDRD, PORTD, PIND, 6, OCR0A, TCCR0A, TCCR0B);
+constexpr auto CPD6 = PWMPin(DDRD, PORTD, PIND, 6, OCR0A, TCCR0A, TCCR0B, 7);
 constexpr auto CPD7 = DigitalPin(DDRD, PORTD, PIND, 7);
 
 constexpr auto CADC0 = AnalogPin(0b0000);
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "bitops.hpp"
+#include "concepts.hpp"
+#include "pins.hpp"
+
+namespace hal {
+
+/*
+ * Pins with all register addresses in template parameters, the pin objects are empty.
+ * Every access compiles to a single sbi, cbi, in or out with constant operands, nothing is stored for the pin.
+ * They work anywhere io_digital_pin or pwm_pin is accepted, the PWM members exist only on the compare output pins.
+ *
+ *     constexpr Pin<PortD, 6> led;
+ *     constexpr auto motor = HBridge(Pin<PortD, 5>{}, Pin<PortB, 4>{}, Pin<PortB, 5>{});
+ */
+
+// The addresses come from the pin constants, after the avr headers DDRB, PORTB and PINB are the macros
+struct PortB {
+    static constexpr uintptr_t MODE = CPB0.modeAddress();
+    static constexpr uintptr_t OUTPUT = CPB0.outputAddress();
+    static constexpr uintptr_t INPUT = CPB0.inputAddress();
+};
+
+struct PortC {
+    static constexpr uintptr_t MODE = CPC0.modeAddress();
+    static constexpr uintptr_t OUTPUT = CPC0.outputAddress();
+    static constexpr uintptr_t INPUT = CPC0.inputAddress();
+};
+
+struct PortD {
+    static constexpr uintptr_t MODE = CPD0.modeAddress();
+    static constexpr uintptr_t OUTPUT = CPD0.outputAddress();
+    static constexpr uintptr_t INPUT = CPD0.inputAddress();
+};
+
+// 8 bit timer compare output of a pin, the same channels as the PWMPin constants in pins.hpp
+template <typename PORT, uint8_t N>
+struct PWMChannel {
+    static constexpr bool AVAILABLE = false;
+};
+
+template <uintptr_t COMPARE_REG, uintptr_t CTRL, uintptr_t PRESCALE_REG, uint8_t COM>
+struct PWMChannelOf {
+    static constexpr bool AVAILABLE = true;
+    static constexpr uintptr_t COMPARE_ADDR = COMPARE_REG;
+    static constexpr uintptr_t CTRL_ADDR = CTRL;
+    static constexpr uintptr_t PRESCALE_ADDR = PRESCALE_REG;
+    static constexpr uint8_t COM_POS = COM;
+};
+
+template <>
+struct PWMChannel<PortB, 3>
+    : PWMChannelOf<CPB3.compareAddress(), CPB3.controlAddress(), CPB3.prescaleAddress(), CPB3.comPosition()> {};
+template <>
+struct PWMChannel<PortD, 3>
+    : PWMChannelOf<CPD3.compareAddress(), CPD3.controlAddress(), CPD3.prescaleAddress(), CPD3.comPosition()> {};
+template <>
+struct PWMChannel<PortD, 5>
+    : PWMChannelOf<CPD5.compareAddress(), CPD5.controlAddress(), CPD5.prescaleAddress(), CPD5.comPosition()> {};
+template <>
+struct PWMChannel<PortD, 6>
+    : PWMChannelOf<CPD6.compareAddress(), CPD6.controlAddress(), CPD6.prescaleAddress(), CPD6.comPosition()> {};
+
+// PUD in MCUCR, both names are avr-libc macros after the avr headers
+constexpr InternalVariable CPUD = InternalVariable(0x55, 4);
+
+// PRESCALE and MODE mean the same as on PWMPin and only matter for compare output pins
+template <typename PORT, uint8_t N, uint8_t PRESCALE = 0b011, PWMMode MODE = PWMMode::FAST>
+class Pin {
+    static_assert(N < 8, "Ports have 8 pins");
+    static_assert(PRESCALE > 0 && PRESCALE <= 0b111, "Prescaler bits out of range");
+
+    using PWM = PWMChannel<PORT, N>;
+
+    static bool _isPullUpEnabled() { return !CPUD.read(); }
+
+   public:
+    // Same interface as DigitalPin, for drivers which work on whole ports
+    static constexpr uintptr_t modeAddress() { return PORT::MODE; }
+    static constexpr uintptr_t outputAddress() { return PORT::OUTPUT; }
+    static constexpr uintptr_t inputAddress() { return PORT::INPUT; }
+    static constexpr uint8_t position() { return N; }
+    static constexpr uint8_t mask() { return 1 << N; }
+
+    // Same pin with different timer settings, Pin<PortD, 3>::with<0b001, PWMMode::PHASE_CORRECT>()
+    template <uint8_t NEW_PRESCALE, PWMMode NEW_MODE = MODE>
+    static constexpr Pin<PORT, N, NEW_PRESCALE, NEW_MODE> with() {
+        return {};
+    }
+
+    void digitalWrite(bool val) const { setBit(PORT::OUTPUT, val, N); }
+
+    bool digitalRead() const { return readBit(PORT::INPUT, N); }
+
+    // Writing a one to PINx toggles the output
+    void toggle() const { setByte(PORT::INPUT, mask()); }
+
+    void setInputMode() const {
+        if (!_isPullUpEnabled()) {
+            digitalWrite(false);
+            nop();
+        }
+        setBit(PORT::MODE, INPUT, N);
+        nop();
+    }
+
+    void setOutputMode() const {
+        if (!_isPullUpEnabled()) {
+            digitalWrite(false);
+            nop();
+        }
+        setBit(PORT::MODE, OUTPUT, N);
+        nop();
+    }
+
+    void setupPWM() const
+        requires PWM::AVAILABLE
+    {
+        setOutputMode();
+        // Fast PWM is WGMx1:0 = 11, phase correct PWM is 01
+        const auto WGMx0 = 0;
+        setBit(PWM::CTRL_ADDR, true, WGMx0);
+        const auto WGMx1 = 1;
+        setBit(PWM::CTRL_ADDR, MODE == PWMMode::FAST, WGMx1);
+        // Non-inverting mode
+        setBit(PWM::CTRL_ADDR, true, PWM::COM_POS);
+        // Replace the clock select bits, WGMx2 stays cleared so the top is 0xFF
+        const uint8_t CS_MASK = 0b111;
+        const uint8_t WGMx2 = 3;
+        const uint8_t keep = readByte(PWM::PRESCALE_ADDR) & ~(CS_MASK | bit(WGMx2));
+        setByte(PWM::PRESCALE_ADDR, keep | PRESCALE);
+    }
+
+    void setPWM(uint8_t val) const
+        requires PWM::AVAILABLE
+    {
+        setByte(PWM::COMPARE_ADDR, val);
+    }
+
+    bool isPWMEnabled() const
+        requires PWM::AVAILABLE
+    {
+        return readBit(PWM::CTRL_ADDR, PWM::COM_POS);
+    }
+};
+
+static_assert(sizeof(Pin<PortB, 0>) == 1, "Pins hold no state");
+static_assert(io_digital_pin<Pin<PortB, 0>> && !pwm_pin<Pin<PortB, 0>>);
+static_assert(io_digital_pin<Pin<PortD, 6>> && pwm_pin<Pin<PortD, 6>>);
+
+}  // namespace hal
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "pins.hpp"
+
+namespace hal {
+
+/*
+ * Compile-time bookkeeping of the hardware every driver takes over.
+ * Drivers declare a claim type listing their pins, timers, peripherals and interrupt vectors,
+ * the application lists the claims of everything it uses once and the build fails on any overlap.
+ * The error is raised inside ResourceConflict<FIRST_OWNER, SECOND_OWNER, SHARED_RESOURCE>, which names all three.
+ *
+ *     HAL_CLAIM_RESOURCES(TimeBaseClaim, SerialClaim, PWMClaim<CPD3>, PinClaim<CPB4, CPB5>)
+ *
+ * Timer1 is claimed per compare channel, so the OC1A and OC1B outputs can belong to different drivers.
+ * Owners of the two channels have to agree on the timer mode and period. ServoMuxClaim takes both.
+ */
+
+// Pins are numbered port * 8 + bit, so they follow from the pin registers
+enum class Resource : uint8_t {
+    PIN_B0 = 0,
+    PIN_B1,
+    PIN_B2,
+    PIN_B3,
+    PIN_B4,
+    PIN_B5,
+    PIN_B6,
+    PIN_B7,
+    PIN_C0,
+    PIN_C1,
+    PIN_C2,
+    PIN_C3,
+    PIN_C4,
+    PIN_C5,
+    PIN_C6,
+    PIN_D0 = 16,
+    PIN_D1,
+    PIN_D2,
+    PIN_D3,
+    PIN_D4,
+    PIN_D5,
+    PIN_D6,
+    PIN_D7,
+    TIMER_0,
+    TIMER_1_A,
+    TIMER_1_B,
+    TIMER_2,
+    UNIT_USART,
+    UNIT_SPI,
+    UNIT_TWI,
+    UNIT_ADC,
+    UNIT_EEPROM,
+    VECTOR_INT0,
+    VECTOR_INT1,
+    VECTOR_PCINT0,
+    VECTOR_PCINT1,
+    VECTOR_PCINT2,
+    VECTOR_TIMER0_COMPA,
+    VECTOR_TIMER0_OVF,
+    VECTOR_TIMER1_COMPA,
+    VECTOR_TIMER1_OVF,
+    VECTOR_USART_RX,
+    VECTOR_USART_UDRE,
+    VECTOR_SPI_STC,
+    VECTOR_TWI,
+    VECTOR_ADC,
+    VECTOR_EE_READY,
+    // No resource, also the end of the list
+    NONE,
+};
+
+static_assert(static_cast<uint8_t>(Resource::NONE) <= 64, "Claims are 64 bit masks");
+
+constexpr uint64_t resourceMask(Resource resource) { return 1ULL << static_cast<uint8_t>(resource); }
+
+constexpr Resource pinResource(uintptr_t input_addr, uint8_t position) {
+    // PINB, PINC and PIND are 3 addresses apart, after the avr headers PINB is the macro, so CPB0 gives the address
+    return static_cast<Resource>((input_addr - CPB0.inputAddress()) / 3 * 8 + position);
+}
+
+// Lowest resource of the mask, NONE for an empty one
+constexpr Resource firstResource(uint64_t mask) {
+    for (uint8_t i = 0; i < static_cast<uint8_t>(Resource::NONE); ++i) {
+        if (mask & (1ULL << i)) return static_cast<Resource>(i);
+    }
+    return Resource::NONE;
+}
+
+// Owner of a fixed set of resources, drivers derive their claim from it
+template <Resource... RESOURCES>
+struct Claim {
+    static constexpr uint64_t MASK = (0ULL | ... | resourceMask(RESOURCES));
+};
+
+// Plain digital use of pins, works with DigitalPin constants and Pin types alike
+template <const auto&... PINS>
+struct PinClaim {
+    static constexpr uint64_t MASK = (0ULL | ... | resourceMask(pinResource(PINS.inputAddress(), PINS.position())));
+};
+
+// Timer of an 8 bit PWM pin, the compare channel for the Timer1 pins
+constexpr Resource pwmTimer(Resource pin) {
+    switch (pin) {
+        case Resource::PIN_D5:
+        case Resource::PIN_D6:
+            return Resource::TIMER_0;
+        case Resource::PIN_B1:
+            return Resource::TIMER_1_A;
+        case Resource::PIN_B2:
+            return Resource::TIMER_1_B;
+        case Resource::PIN_B3:
+        case Resource::PIN_D3:
+            return Resource::TIMER_2;
+        default:
+            return Resource::NONE;
+    }
+}
+
+// PWM output, the pin together with its timer
+template <const auto& PIN>
+struct PWMClaim {
+    static constexpr Resource PIN_RESOURCE = pinResource(PIN.inputAddress(), PIN.position());
+    static_assert(pwmTimer(PIN_RESOURCE) != Resource::NONE, "The pin has no timer output");
+
+    static constexpr uint64_t MASK = resourceMask(PIN_RESOURCE) | resourceMask(pwmTimer(PIN_RESOURCE));
+};
+
+// Fails when two owners share a resource, the instantiation names both owners and the resource
+template <typename FIRST, typename SECOND, Resource SHARED = firstResource(FIRST::MASK & SECOND::MASK)>
+struct ResourceConflict {
+    static_assert(SHARED == Resource::NONE, "Two drivers claim the same resource");
+    static constexpr bool FREE = true;
+};
+
+template <typename FIRST, typename... REST>
+constexpr bool claimResources() {
+    if constexpr (sizeof...(REST) == 0) {
+        return true;
+    } else {
+        return (ResourceConflict<FIRST, REST>::FREE && ...) && claimResources<REST...>();
+    }
+}
+
+// Lists every owner of the application once, at namespace scope
+#define HAL_CLAIM_RESOURCES(...) static_assert(hal::claimResources<__VA_ARGS__>());
+
+}  // namespace hal
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "pins.hpp"
+#include "spi.hpp"
+#include "timers.hpp"
+
+namespace hal {
+
+/*
+ * SD and SDHC cards (18_SDCARD) in SPI mode, on the SPI unit or any bus with the same blocking interface.
+ * Blocks are 512 bytes and numbered from 0 on both card types, SDSC cards get byte addresses internally.
+ * The driver keeps no buffer of its own, the caller passes one block buffer and the layers above share it.
+ * Initialization runs below 400 kHz, afterwards the bus switches to CLOCK.
+ * Timeouts use millis(), so setupTimer() has to run first.
+ *
+ *     uint8_t block[SD_BLOCK_SIZE];
+ *     SDCard<> card(CPB1);
+ *     setupTimer();
+ *     SPI.begin();
+ *     if (card.begin() && card.readBlock(0, block)) { ... }
+ *
+ * Runs of consecutive blocks stream, the card skips the per block command and programs in the background:
+ *
+ *     card.writeStart(first, count);
+ *     for (...) card.writeData(block);
+ *     card.writeStop();
+ *
+ * With CRC the data blocks are checked in both directions, a CRC16 over every block computed on the CPU.
+ * Claim the bus with SPIClaim and the chip select with PinClaim, unless it is SS, which SPIClaim covers.
+ */
+
+constexpr uint16_t SD_BLOCK_SIZE = 512;
+
+// CRC7 of a command frame, the card wants it in the upper 7 bits of the last byte
+constexpr uint8_t sdCommandCrc(const uint8_t* data, uint8_t length) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; ++i) {
+        uint8_t val = data[i];
+        for (uint8_t j = 0; j < 8; ++j) {
+            crc <<= 1;
+            if ((val ^ crc) & 0x80) {
+                crc ^= 0x09;
+            }
+            val <<= 1;
+        }
+    }
+    return crc & 0x7F;
+}
+
+// CRC16-CCITT of a data block, bytewise without a table
+constexpr uint16_t sdDataCrc(const uint8_t* data, uint16_t length) {
+    uint16_t crc = 0;
+    for (uint16_t i = 0; i < length; ++i) {
+        crc = static_cast<uint8_t>(crc >> 8) | static_cast<uint16_t>(crc << 8);
+        crc ^= data[i];
+        crc ^= static_cast<uint8_t>(crc & 0xFF) >> 4;
+        crc ^= static_cast<uint16_t>(crc << 12);
+        crc ^= static_cast<uint16_t>((crc & 0xFF) << 5);
+    }
+    return crc;
+}
+
+enum class SDError : uint8_t {
+    NONE,
+    // No answer to the reset, usually no card in the slot
+    NO_CARD,
+    // Rejected the voltage range or the check pattern
+    UNSUPPORTED,
+    // Still initializing after a second
+    INIT_TIMEOUT,
+    // A command was answered with an error
+    COMMAND,
+    // Data arrived with a wrong CRC, or the card saw one on written data
+    CRC,
+    // An error token instead of the data
+    READ_TOKEN,
+    // Written data was refused
+    WRITE_REJECTED,
+    // Busy or silent for longer than the card may be
+    TIMEOUT,
+};
+
+template <auto& BUS = SPI, bool CRC = true, uint32_t CLOCK = 8000000>
+class SDCard {
+    static constexpr uint8_t GO_IDLE_STATE = 0;
+    static constexpr uint8_t SEND_IF_COND = 8;
+    static constexpr uint8_t SEND_CSD = 9;
+    static constexpr uint8_t STOP_TRANSMISSION = 12;
+    static constexpr uint8_t SET_BLOCKLEN = 16;
+    static constexpr uint8_t READ_SINGLE_BLOCK = 17;
+    static constexpr uint8_t READ_MULTIPLE_BLOCK = 18;
+    static constexpr uint8_t WRITE_BLOCK = 24;
+    static constexpr uint8_t WRITE_MULTIPLE_BLOCK = 25;
+    static constexpr uint8_t APP_CMD = 55;
+    static constexpr uint8_t READ_OCR = 58;
+    static constexpr uint8_t CRC_ON_OFF = 59;
+    // Application commands, after APP_CMD
+    static constexpr uint8_t SET_WR_BLK_ERASE_COUNT = 23;
+    static constexpr uint8_t SD_SEND_OP_COND = 41;
+
+    static constexpr uint8_t R1_READY = 0x00;
+    static constexpr uint8_t R1_IDLE = 0x01;
+    static constexpr uint8_t R1_ILLEGAL_COMMAND = 0x04;
+    // 2.7 to 3.6 V and the check pattern
+    static constexpr uint32_t IF_COND = 0x1AA;
+    // Host supports high capacity cards
+    static constexpr uint32_t HCS = 1UL << 30;
+
+    static constexpr uint8_t START_BLOCK = 0xFE;
+    static constexpr uint8_t START_MULTIPLE_WRITE = 0xFC;
+    static constexpr uint8_t STOP_MULTIPLE_WRITE = 0xFD;
+    static constexpr uint8_t DATA_ACCEPTED = 0x05;
+    static constexpr uint8_t DATA_CRC_ERROR = 0x0B;
+
+    static constexpr uint16_t INIT_TIMEOUT_MS = 1000;
+    static constexpr uint16_t READ_TIMEOUT_MS = 300;
+    static constexpr uint16_t WRITE_TIMEOUT_MS = 600;
+
+    const SPIDevice _slow;
+    const SPIDevice _fast;
+    bool _initialized = false;
+    bool _high_capacity = false;
+    SDError _error = SDError::NONE;
+
+    const SPIDevice& device() const { return _initialized ? _fast : _slow; }
+
+    bool fail(SDError error) {
+        _error = error;
+        return false;
+    }
+
+    void select() { BUS.beginTransaction(device()); }
+
+    void deselect() {
+        device().deselect();
+        // The card lets go of MISO only on a clock with its chip select high
+        BUS.transfer(0xFF);
+        BUS.endTransaction(device());
+    }
+
+    // The card holds MISO low while it is busy programming
+    bool waitReady(uint16_t timeout_ms) {
+        uint32_t start = millis();
+        while (BUS.transfer(0xFF) != 0xFF) {
+            if (millis() - start > timeout_ms) return fail(SDError::TIMEOUT);
+        }
+        return true;
+    }
+
+    uint32_t address(uint32_t block) const { return _high_capacity ? block : block * SD_BLOCK_SIZE; }
+
+    // R1 answer, 0xFF when the card stayed silent
+    uint8_t command(uint8_t index, uint32_t arg) {
+        if (index != GO_IDLE_STATE && index != STOP_TRANSMISSION && !waitReady(WRITE_TIMEOUT_MS)) return 0xFF;
+        uint8_t frame[6] = {static_cast<uint8_t>(0x40 | index), static_cast<uint8_t>(arg >> 24),
+                            static_cast<uint8_t>(arg >> 16), static_cast<uint8_t>(arg >> 8),
+                            static_cast<uint8_t>(arg), 0};
+        frame[5] = static_cast<uint8_t>(sdCommandCrc(frame, 5) << 1) | 1;
+        BUS.send(frame, sizeof(frame));
+        if (index == STOP_TRANSMISSION) {
+            // The byte right after the stop still belongs to the data
+            BUS.transfer(0xFF);
+        }
+        uint8_t r1 = 0xFF;
+        for (uint8_t i = 0; i < 10 && (r1 & 0x80); ++i) {
+            r1 = BUS.transfer(0xFF);
+        }
+        return r1;
+    }
+
+    uint8_t appCommand(uint8_t index, uint32_t arg) {
+        command(APP_CMD, 0);
+        return command(index, arg);
+    }
+
+    bool receiveData(uint8_t* data, uint16_t length) {
+        uint32_t start = millis();
+        uint8_t token;
+        while ((token = BUS.transfer(0xFF)) == 0xFF) {
+            if (millis() - start > READ_TIMEOUT_MS) return fail(SDError::TIMEOUT);
+        }
+        if (token != START_BLOCK) return fail(SDError::READ_TOKEN);
+        BUS.receive(data, length);
+        uint8_t crc[2];
+        BUS.receive(crc, 2);
+        if (CRC && sdDataCrc(data, length) != ((crc[0] << 8) | crc[1])) return fail(SDError::CRC);
+        return true;
+    }
+
+    // Leaves the card programming, the next command waits for it
+    bool sendData(uint8_t token, const uint8_t* data) {
+        uint16_t crc = CRC ? sdDataCrc(data, SD_BLOCK_SIZE) : 0xFFFF;
+        BUS.transfer(token);
+        BUS.send(data, SD_BLOCK_SIZE);
+        BUS.transfer(crc >> 8);
+        BUS.transfer(crc);
+        uint8_t response = BUS.transfer(0xFF) & 0x1F;
+        if (response == DATA_CRC_ERROR) return fail(SDError::CRC);
+        if (response != DATA_ACCEPTED) return fail(SDError::WRITE_REJECTED);
+        return true;
+    }
+
+    bool initialize() {
+        uint32_t start = millis();
+        while (command(GO_IDLE_STATE, 0) != R1_IDLE) {
+            if (millis() - start > INIT_TIMEOUT_MS) return fail(SDError::NO_CARD);
+        }
+        // Version 2 cards echo the voltage and the pattern, version 1 cards do not know the command
+        bool version2 = !(command(SEND_IF_COND, IF_COND) & R1_ILLEGAL_COMMAND);
+        if (version2) {
+            uint8_t r7[4];
+            BUS.receive(r7, 4);
+            if (((r7[2] << 8) | r7[3]) != (IF_COND & 0xFFF)) return fail(SDError::UNSUPPORTED);
+        }
+        if (CRC && command(CRC_ON_OFF, 1) != R1_IDLE) return fail(SDError::COMMAND);
+        while (appCommand(SD_SEND_OP_COND, version2 ? HCS : 0) != R1_READY) {
+            if (millis() - start > INIT_TIMEOUT_MS) return fail(SDError::INIT_TIMEOUT);
+        }
+        if (version2) {
+            if (command(READ_OCR, 0) != R1_READY) return fail(SDError::COMMAND);
+            uint8_t ocr[4];
+            BUS.receive(ocr, 4);
+            // CCS, the card is addressed in blocks
+            _high_capacity = ocr[0] & 0x40;
+        }
+        // SDHC blocks are 512 bytes anyway
+        if (!_high_capacity && command(SET_BLOCKLEN, SD_BLOCK_SIZE) != R1_READY) return fail(SDError::COMMAND);
+        return true;
+    }
+
+   public:
+    explicit SDCard(const DigitalPin& chip_select)
+        : _slow(chip_select, SPISettings(400000)), _fast(chip_select, SPISettings(CLOCK)) {}
+
+    // The bus has to be running already
+    bool begin() {
+        _initialized = false;
+        _high_capacity = false;
+        _error = SDError::NONE;
+        BUS.attach(_slow);
+        // At least 74 clocks with the chip select high put the card into its native mode
+        BUS.beginTransaction(_slow);
+        _slow.deselect();
+        for (uint8_t i = 0; i < 10; ++i) {
+            BUS.transfer(0xFF);
+        }
+        BUS.endTransaction(_slow);
+
+        select();
+        bool ok = initialize();
+        deselect();
+        _initialized = ok;
+        return ok;
+    }
+
+    bool initialized() const { return _initialized; }
+
+    bool highCapacity() const { return _high_capacity; }
+
+    // Cause of the last failure
+    SDError error() const { return _error; }
+
+    uint32_t frequency() const { return device().settings.frequency(); }
+
+    // Size of the card from the CSD register, 0 on failure
+    uint32_t blockCount() {
+        uint8_t csd[16];
+        select();
+        bool ok = command(SEND_CSD, 0) == R1_READY ? receiveData(csd, sizeof(csd)) : fail(SDError::COMMAND);
+        deselect();
+        if (!ok) return 0;
+        if (csd[0] >> 6 == 1) {
+            // uint8_t promotes to a 16 bit int, csd[8] << 8 would sign-extend into the upper bits
+            uint32_t size = (static_cast<uint32_t>(csd[7] & 0x3F) << 16) | (static_cast<uint32_t>(csd[8]) << 8);
+            size |= csd[9];
+            return (size + 1) << 10;
+        }
+        uint16_t size = ((csd[6] & 0x03) << 10) | (csd[7] << 2) | (csd[8] >> 6);
+        uint8_t multiplier = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+        uint8_t block_length = csd[5] & 0x0F;
+        return static_cast<uint32_t>(size + 1) << (multiplier + 2 + block_length - 9);
+    }
+
+    // Still programming written data
+    bool busy() {
+        select();
+        bool res = BUS.transfer(0xFF) != 0xFF;
+        deselect();
+        return res;
+    }
+
+    bool readBlock(uint32_t block, uint8_t* data) {
+        select();
+        bool ok = command(READ_SINGLE_BLOCK, address(block)) == R1_READY ? receiveData(data, SD_BLOCK_SIZE)
+                                                                          : fail(SDError::COMMAND);
+        deselect();
+        return ok;
+    }
+
+    // Returns once the card took the data, it programs them while the caller goes on
+    bool writeBlock(uint32_t block, const uint8_t* data) {
+        select();
+        bool ok = command(WRITE_BLOCK, address(block)) == R1_READY ? sendData(START_BLOCK, data)
+                                                                    : fail(SDError::COMMAND);
+        deselect();
+        return ok;
+    }
+
+    // Reads blocks from BLOCK on with readData() until readStop()
+    bool readStart(uint32_t block) {
+        select();
+        bool ok = command(READ_MULTIPLE_BLOCK, address(block)) == R1_READY || fail(SDError::COMMAND);
+        deselect();
+        return ok;
+    }
+
+    bool readData(uint8_t* data) {
+        select();
+        bool ok = receiveData(data, SD_BLOCK_SIZE);
+        deselect();
+        return ok;
+    }
+
+    bool readStop() {
+        select();
+        command(STOP_TRANSMISSION, 0);
+        bool ok = waitReady(READ_TIMEOUT_MS);
+        deselect();
+        return ok;
+    }
+
+    // Writes blocks from BLOCK on with writeData() until writeStop(), a known count lets the card pre-erase
+    bool writeStart(uint32_t block, uint32_t count = 0) {
+        select();
+        bool ok = (count == 0 || appCommand(SET_WR_BLK_ERASE_COUNT, count) == R1_READY) &&
+                  command(WRITE_MULTIPLE_BLOCK, address(block)) == R1_READY;
+        deselect();
+        return ok || fail(SDError::COMMAND);
+    }
+
+    // Waits for the previous block to be programmed, then sends this one
+    bool writeData(const uint8_t* data) {
+        select();
+        bool ok = waitReady(WRITE_TIMEOUT_MS) && sendData(START_MULTIPLE_WRITE, data);
+        deselect();
+        return ok;
+    }
+
+    bool writeStop() {
+        select();
+        bool ok = waitReady(WRITE_TIMEOUT_MS);
+        if (ok) {
+            BUS.transfer(STOP_MULTIPLE_WRITE);
+            // One byte passes before the card signals busy
+            BUS.transfer(0xFF);
+            ok = waitReady(WRITE_TIMEOUT_MS);
+        }
+        deselect();
+        return ok;
+    }
+};
+
+}  // namespace hal
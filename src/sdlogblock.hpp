@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace hal {
+
+/*
+ * Layout of the blocks SDLogger writes, shared with tools/sdlogdump.cpp on the PC.
+ * Both sides are little endian, the fields are laid out without padding.
+ *
+ * A session writes blocks with sequence 0, 1, 2, ... from the first block of the region on,
+ * every block repeats its sequence in the last 4 bytes. A block belongs to the log when the magic,
+ * the session of block 0 and both copies of the expected sequence match, the first one which does not
+ * is where the session ended, by power loss as well. Older sessions behind it carry a lower session number.
+ */
+
+constexpr uint32_t SD_LOG_MAGIC = 0x474C4453;  // "SDLG"
+constexpr uint16_t SD_LOG_BLOCK_SIZE = 512;
+
+struct SDLogHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t session;
+    // Records in this block, fewer than fit only in the last block of a session
+    uint16_t records;
+    uint16_t record_size;
+    // Records dropped since the previous block because both buffers were full
+    uint16_t lost;
+};
+
+static_assert(sizeof(SDLogHeader) == 16, "The PC tool expects the header without padding");
+
+// Records fill the space between the header and the trailing sequence
+constexpr uint16_t SD_LOG_PAYLOAD = SD_LOG_BLOCK_SIZE - sizeof(SDLogHeader) - sizeof(uint32_t);
+
+}  // namespace hal
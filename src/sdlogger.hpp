@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "atomic.hpp"
+#include "sdcard.hpp"
+#include "sdlogblock.hpp"
+
+namespace hal {
+
+/*
+ * Append-only logger writing fixed size records straight into a region of the card, without a file system.
+ * The whole session is one open-ended multiple block write, the card pre-erases the region when it starts.
+ * Records go into one of two block buffers, usually from an interrupt, while the main loop sends the other one.
+ * When both are full the record is dropped and counted, the next block sent reports how many.
+ * Once the region is full or the card failed, every record is dropped and counted in lost() until end(),
+ * which has to run either way, it closes the multiple block write.
+ *
+ *     struct Sample { uint16_t time; uint16_t value; };
+ *     SDLogger<Sample, SDCard<SPI, false>> logger(card, 1000000, 500000);
+ *
+ *     ISR(ADC_vect) { logger.add(Sample{...}); }
+ *
+ *     logger.begin();
+ *     while (running) {
+ *         logger.update();
+ *     }
+ *     logger.end();
+ *
+ * Every session starts again at the first block, tools/sdlogdump.cpp reads it back on a PC.
+ * The two buffers cover a programming pause of the card only as long as one block takes to fill.
+ * The sustainable record rate depends on the card and has not been measured, lost() tells whether it kept up.
+ */
+template <typename RECORD, stream_block_device CARD>
+class SDLogger {
+    static constexpr uint16_t RECORDS = SD_LOG_PAYLOAD / sizeof(RECORD);
+    static_assert(RECORDS > 0, "A record has to fit into a block");
+
+    CARD& _card;
+    const uint32_t _first;
+    const uint32_t _blocks;
+    uint8_t _buffers[2][SD_LOG_BLOCK_SIZE];
+    // Filled from the interrupt
+    volatile uint8_t _fill = 0;
+    volatile uint16_t _count = 0;
+    volatile bool _full[2] = {};
+    volatile uint16_t _lost = 0;
+    volatile uint32_t _lost_total = 0;
+    // Sent from the main loop
+    uint8_t _send = 0;
+    uint32_t _sequence = 0;
+    uint16_t _session = 0;
+    // Records are taken and sent
+    volatile bool _running = false;
+    // The multiple block write is open, stays so after the region filled up or the card failed until end()
+    volatile bool _open = false;
+
+    // Header and trailer, the records are in place already
+    void seal(uint8_t* block, uint16_t records) {
+        SDLogHeader header;
+        header.magic = SD_LOG_MAGIC;
+        header.sequence = _sequence;
+        header.session = _session;
+        header.records = records;
+        header.record_size = sizeof(RECORD);
+        {
+            InterruptLock lock;
+            header.lost = _lost;
+            _lost = 0;
+        }
+        memcpy(block, &header, sizeof(header));
+        memcpy(block + SD_LOG_BLOCK_SIZE - sizeof(_sequence), &_sequence, sizeof(_sequence));
+    }
+
+    // Sends the buffer in turn once it is full, false when the card failed or the region is full,
+    // the buffer stays full then and end() counts it as lost
+    bool sendNext(uint16_t records) {
+        uint8_t* block = _buffers[_send];
+        seal(block, records);
+        if (_sequence >= _blocks || !_card.writeData(block)) {
+            _running = false;
+            return false;
+        }
+        ++_sequence;
+        _full[_send] = false;
+        _send ^= 1;
+        return true;
+    }
+
+   public:
+    // The region is FIRST and the following BLOCKS blocks, nothing else may live there
+    SDLogger(CARD& card, uint32_t first, uint32_t blocks) : _card(card), _first(first), _blocks(blocks) {}
+
+    // Starts a session one above the one found in the region, the card has to be initialized
+    bool begin() {
+        _session = 1;
+        if (_card.readBlock(_first, _buffers[0])) {
+            SDLogHeader previous;
+            memcpy(&previous, _buffers[0], sizeof(previous));
+            if (previous.magic == SD_LOG_MAGIC) {
+                _session = previous.session + 1;
+            }
+        }
+        // The pre-erase count has 23 bits
+        if (!_card.writeStart(_first, _blocks < 0x7FFFFF ? _blocks : 0x7FFFFF)) return false;
+        InterruptLock lock;
+        _fill = 0;
+        _count = 0;
+        _full[0] = false;
+        _full[1] = false;
+        _lost = 0;
+        _lost_total = 0;
+        _send = 0;
+        _sequence = 0;
+        _running = true;
+        _open = true;
+        return true;
+    }
+
+    // From the interrupt or with interrupts off, false when the record was dropped
+    bool add(const RECORD& record) {
+        if (!_open) return false;
+        uint8_t fill = _fill;
+        if (!_running || _full[fill]) {
+            _lost = _lost + 1;
+            _lost_total = _lost_total + 1;
+            return false;
+        }
+        uint16_t count = _count;
+        memcpy(_buffers[fill] + sizeof(SDLogHeader) + count * sizeof(RECORD), &record, sizeof(RECORD));
+        if (++count == RECORDS) {
+            count = 0;
+            _full[fill] = true;
+            _fill = fill ^ 1;
+        }
+        _count = count;
+        return true;
+    }
+
+    // Sends a full buffer when there is one and the card is ready for it, returns at once otherwise
+    bool update() {
+        if (!_running) return false;
+        if (!_full[_send] || _card.busy()) return true;
+        return sendNext(RECORDS);
+    }
+
+    // Writes what is buffered, the partial block as well, and closes the write.
+    // False when records could not be written, they are counted in lost()
+    bool end() {
+        if (!_open) return false;
+        uint16_t partial;
+        uint8_t last;
+        bool ok;
+        {
+            InterruptLock lock;
+            // add() counts everything from now on as lost
+            ok = _running;
+            _running = false;
+            partial = _count;
+            last = _fill;
+            _full[last] = _full[last] || partial > 0;
+        }
+        // The partial buffer is always the newer one
+        while (ok && _full[_send]) {
+            ok = sendNext(_send == last && partial > 0 ? partial : RECORDS);
+        }
+        // What the region or the card did not take any more
+        for (uint8_t i = 0; i < 2; ++i) {
+            if (_full[i]) {
+                _full[i] = false;
+                InterruptLock lock;
+                _lost_total = _lost_total + (i == last && partial > 0 ? partial : RECORDS);
+            }
+        }
+        _open = false;
+        // The stop token goes out even after a failure, the card stays in the multiple block write otherwise
+        return _card.writeStop() && ok;
+    }
+
+    bool running() const { return _running; }
+
+    uint16_t session() const { return _session; }
+
+    // Blocks sent so far in this session
+    uint32_t written() const { return _sequence; }
+
+    uint32_t lost() const {
+        InterruptLock lock;
+        return _lost_total;
+    }
+};
+
+}  // namespace hal
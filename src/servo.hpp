@@ -0,0 +1,170 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+
+namespace hal {
+
+/*
+ * Hobby servos on OC1A (PB1) and OC1B (PB2), Timer1 in mode 14 with ICR1 giving a 20 ms period.
+ * At 16 MHz the prescaler is 8, one timer tick is 0.5 us, and the pulses are generated entirely by the hardware.
+ * With a speed limit set, the Timer1 overflow interrupt moves the pulse once per period until the target is reached
+ * and switches itself off afterwards.
+ */
+
+constexpr uint32_t SERVO_FREQUENCY = 50;
+
+using ServoPin = Timer1PWMPin<SERVO_FREQUENCY>;
+
+constexpr uint16_t SERVO_PERIOD_US = 1000000 / SERVO_FREQUENCY;
+constexpr uint16_t SERVO_TICKS_PER_MS = (ServoPin::TOP + 1) / (SERVO_PERIOD_US / 1000);
+
+static_assert((ServoPin::TOP + 1) % (SERVO_PERIOD_US / 1000) == 0, "F_CPU does not give whole ticks per millisecond");
+
+constexpr uint8_t CTOIE1 = 0;
+
+class Servo {
+    const ServoPin PIN;
+    uint16_t _min_ticks = usToTicks(1000);
+    uint16_t _max_ticks = usToTicks(2000);
+    // Ticks per period, 0 moves straight to the target
+    volatile uint16_t _step = 0;
+    volatile uint16_t _target = 0;
+    volatile uint16_t _current = 0;
+    bool _attached = false;
+
+    static constexpr uint16_t usToTicks(uint16_t us) {
+        return static_cast<uint32_t>(us) * SERVO_TICKS_PER_MS / 1000;
+    }
+
+    static constexpr uint16_t ticksToUs(uint16_t ticks) {
+        return static_cast<uint32_t>(ticks) * 1000 / SERVO_TICKS_PER_MS;
+    }
+
+    void setTarget(uint16_t ticks) {
+        if (ticks < _min_ticks) ticks = _min_ticks;
+        if (ticks > _max_ticks) ticks = _max_ticks;
+        cli();
+        _target = ticks;
+        if (_step == 0 || !_attached) {
+            _current = ticks;
+            PIN.setDuty(ticks);
+        } else if (_current != ticks) {
+            setBit(CTIMSK1, true, CTOIE1);
+        }
+        sei();
+    }
+
+   public:
+    constexpr Servo(const ServoPin& pin) : PIN(pin) {}
+
+    // Pulse widths for 0 and 180 degrees, starts in the middle
+    void attach(uint16_t min_us = 1000, uint16_t max_us = 2000) {
+        _min_ticks = usToTicks(min_us);
+        _max_ticks = usToTicks(max_us);
+        uint16_t middle = (_min_ticks + _max_ticks) / 2;
+        cli();
+        _target = middle;
+        _current = middle;
+        PIN.setDuty(middle);
+        PIN.setupPWM();
+        _attached = true;
+        sei();
+    }
+
+    // Stops the pulses, the pin stays low
+    void detach() {
+        cli();
+        PIN.disconnect();
+        _attached = false;
+        sei();
+    }
+
+    bool attached() const { return _attached; }
+
+    void writeMicroseconds(uint16_t us) { setTarget(usToTicks(us)); }
+
+    void write(uint8_t angle) {
+        if (angle > 180) angle = 180;
+        setTarget(_min_ticks + static_cast<uint32_t>(_max_ticks - _min_ticks) * angle / 180);
+    }
+
+    // Pulse width currently output, lags behind the target while slewing
+    uint16_t readMicroseconds() const {
+        cli();
+        uint16_t current = _current;
+        sei();
+        return ticksToUs(current);
+    }
+
+    uint8_t read() const {
+        cli();
+        uint16_t current = _current;
+        sei();
+        return static_cast<uint32_t>(current - _min_ticks) * 180 / (_max_ticks - _min_ticks);
+    }
+
+    // Limits the slew rate to roughly US_PER_SECOND of pulse width change, 0 removes the limit
+    void setSpeed(uint16_t us_per_second) {
+        uint16_t step = static_cast<uint32_t>(us_per_second) * SERVO_TICKS_PER_MS / 1000 / SERVO_FREQUENCY;
+        if (us_per_second != 0 && step == 0) step = 1;
+        cli();
+        _step = step;
+        sei();
+        if (step == 0) {
+            setTarget(_target);
+        }
+    }
+
+    bool moving() const {
+        cli();
+        bool res = _current != _target;
+        sei();
+        return res;
+    }
+
+    // Called once per period from the overflow interrupt, returns whether the servo still moves
+    bool slew() {
+        uint16_t current = _current;
+        uint16_t target = _target;
+        if (current == target) return false;
+        uint16_t step = _step == 0 ? 0xFFFF : _step;
+        if (current < target) {
+            current = target - current > step ? current + step : target;
+        } else {
+            current = current - target > step ? current - step : target;
+        }
+        _current = current;
+        PIN.setDuty(current);
+        return current != target;
+    }
+};
+
+// The servos used out of ServoA and ServoB, ServoClaim<CPB2> leaves compare A to another mode 14 user.
+// The overflow interrupt is always defined
+template <const auto&... PINS>
+struct ServoClaim {
+    static_assert(((PWMClaim<PINS>::PIN_RESOURCE == Resource::PIN_B1 ||
+                    PWMClaim<PINS>::PIN_RESOURCE == Resource::PIN_B2) && ...),
+                  "Servos are on OC1A and OC1B only");
+
+    static constexpr uint64_t MASK = (resourceMask(Resource::VECTOR_TIMER1_OVF) | ... | PWMClaim<PINS>::MASK);
+};
+
+Servo ServoA(CPB1PWM<SERVO_FREQUENCY>);
+Servo ServoB(CPB2PWM<SERVO_FREQUENCY>);
+
+// OCR1x is double buffered in mode 14, values written here are used from the next period
+ISR(TIMER1_OVF_vect) {
+    bool moving = ServoA.slew();
+    moving |= ServoB.slew();
+    if (!moving) {
+        setBit(CTIMSK1, false, CTOIE1);
+    }
+}
+
+}  // namespace hal
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "types.hpp"
+
+namespace hal {
+
+/*
+ * Up to 12 servos on arbitrary DigitalPins, all timed by the Timer1 compare A interrupt.
+ * Timer1 runs a 20 ms period in CTC mode 12 with ICR1 as top. Unlike the PWM modes, OCR1A takes a new value
+ * right away there, so the interrupt can move the compare to the next edge of the same period.
+ * The timer drives no PWM output then, the mux takes over both compare channels.
+ *
+ * All pulses start together, update() sorts the pulse ends into a schedule, which the interrupt only walks.
+ * The interrupt is requested LEAD ticks early and spins on TCNT1 until the exact edge,
+ * so the varying interrupt latency does not show up as jitter.
+ * Edges closer together than the interrupt overhead are handled by the same interrupt.
+ * maxLateTicks() tells whether an edge ever came late, when other interrupts held this one back past the lead.
+ *
+ *     ServoMux<3> servos(CPD4, CPD7, CPB0);
+ *     HAL_SERVO_MUX_ISR(servos)
+ *
+ *     servos.attach();
+ *     servos.write(0, 90);
+ *     servos.update();
+ */
+
+// CTC with ICR1 as top has the same period as fast PWM
+constexpr Timer1Clock SERVO_MUX_CLOCK = Timer1Clock::forFrequency<50, PWMMode::FAST>();
+constexpr uint16_t SERVO_MUX_TICKS_PER_MS = (SERVO_MUX_CLOCK.top + 1) / 20;
+// Interrupt entry with the prologue, about 64 cycles, in ticks
+constexpr uint16_t SERVO_MUX_LEAD = (64 + SERVO_MUX_CLOCK.divider - 1) / SERVO_MUX_CLOCK.divider;
+// Edges closer than this are handled without leaving the interrupt, covers the exit and the next entry
+constexpr uint16_t SERVO_MUX_MIN_GAP = SERVO_MUX_LEAD + (128 + SERVO_MUX_CLOCK.divider - 1) / SERVO_MUX_CLOCK.divider;
+// First pulse edge, leaves room to request the interrupt early
+constexpr uint16_t SERVO_MUX_START = 2 * SERVO_MUX_LEAD;
+
+constexpr uint8_t COCIE1A = 1;
+
+template <uint8_t N>
+class ServoMux {
+    static_assert(N > 0 && N <= 12, "One compare channel handles at most 12 servos");
+
+    struct Edge {
+        uint16_t time;
+        // Data address of the PORTx register, 0x25 to 0x2B, all of them fit into a byte
+        uint8_t port;
+        uint8_t mask;
+        bool rising;
+    };
+
+    // Pulses start on at most three ports, then one falling edge per servo
+    static constexpr uint8_t MAX_EDGES = N + 3;
+
+    uint8_t _ports[N];
+    uint8_t _masks[N];
+    uint16_t _pulses[N] = {};
+    uint16_t _min_ticks = usToTicks(1000);
+    uint16_t _max_ticks = usToTicks(2000);
+
+    Edge _schedule[2][MAX_EDGES];
+    uint8_t _counts[2] = {};
+    volatile uint8_t _active = 0;
+    volatile bool _pending = false;
+    uint8_t _index = 0;
+    uint16_t _max_late_ticks = 0;
+    uint16_t _last_interrupt_ticks = 0;
+    uint16_t _max_interrupt_ticks = 0;
+
+    static constexpr uint16_t usToTicks(uint16_t us) {
+        return static_cast<uint32_t>(us) * SERVO_MUX_TICKS_PER_MS / 1000;
+    }
+
+    void setCompare(uint16_t time) { setShort(COCR1A, time - SERVO_MUX_LEAD); }
+
+    // The edges all lie early in the period, the interrupt never spans the wrap at top
+    void recordInterrupt(uint16_t start) {
+        _last_interrupt_ticks = readShort(CTCNT1) - start;
+        if (_last_interrupt_ticks > _max_interrupt_ticks) {
+            _max_interrupt_ticks = _last_interrupt_ticks;
+        }
+    }
+
+    void addEdge(Edge* edges, uint8_t& count, uint16_t time, uint8_t port, uint8_t mask, bool rising) {
+        // Merge edges on the same port at the same time into one write
+        for (uint8_t i = 0; i < count; ++i) {
+            if (edges[i].time == time && edges[i].port == port && edges[i].rising == rising) {
+                edges[i].mask |= mask;
+                return;
+            }
+        }
+        edges[count++] = Edge{time, port, mask, rising};
+    }
+
+   public:
+    template <typename... Pins>
+    constexpr ServoMux(const Pins&... pins)
+        : _ports{static_cast<uint8_t>(pins.outputAddress())...}, _masks{pins.mask()...} {
+        static_assert(sizeof...(Pins) == N, "Pin count has to match the servo count");
+    }
+
+    // Pulse widths for 0 and 180 degrees, servos start without pulses
+    void attach(uint16_t min_us = 1000, uint16_t max_us = 2000) {
+        _min_ticks = usToTicks(min_us);
+        _max_ticks = usToTicks(max_us);
+        for (uint8_t i = 0; i < N; ++i) {
+            // DDRx sits right below PORTx
+            setByte(_ports[i], readByte(_ports[i]) & ~_masks[i]);
+            setByte(_ports[i] - 1, readByte(_ports[i] - 1) | _masks[i]);
+        }
+        update();
+        cli();
+        // Mode 12 with ICR1 as top, the compare channels only raise interrupts, OC1A and OC1B are disconnected
+        setByte(CTCCR1A, 0);
+        const uint8_t CWGM12 = 3;
+        const uint8_t CWGM13 = 4;
+        setByte(CTCCR1B, bit(CWGM13) | bit(CWGM12) | SERVO_MUX_CLOCK.cs_bits);
+        setShort(CICR1, SERVO_MUX_CLOCK.top);
+        // A count left above the new top would run up to 0xFFFF first
+        setShort(CTCNT1, 0);
+        _active = _active ^ 1;
+        _pending = false;
+        _index = 0;
+        setCompare(_schedule[_active][0].time);
+        setBit(CTIMSK1, true, COCIE1A);
+        sei();
+    }
+
+    void detach() {
+        cli();
+        setBit(CTIMSK1, false, COCIE1A);
+        for (uint8_t i = 0; i < N; ++i) {
+            setByte(_ports[i], readByte(_ports[i]) & ~_masks[i]);
+        }
+        sei();
+    }
+
+    // Takes effect on update()
+    void writeMicroseconds(uint8_t channel, uint16_t us) {
+        uint16_t ticks = usToTicks(us);
+        if (ticks < _min_ticks) ticks = _min_ticks;
+        if (ticks > _max_ticks) ticks = _max_ticks;
+        _pulses[channel] = ticks;
+    }
+
+    // Takes effect on update()
+    void write(uint8_t channel, uint8_t angle) {
+        if (angle > 180) angle = 180;
+        _pulses[channel] = _min_ticks + static_cast<uint32_t>(_max_ticks - _min_ticks) * angle / 180;
+    }
+
+    // Stops the pulses of one servo, takes effect on update()
+    void disable(uint8_t channel) { _pulses[channel] = 0; }
+
+    // Sorts the pulses into the schedule, used from the next period
+    void update() {
+        cli();
+        // The interrupt must not swap to the buffer while it is written
+        _pending = false;
+        uint8_t target = _active ^ 1;
+        sei();
+
+        Edge* edges = _schedule[target];
+        uint8_t count = 0;
+        uint8_t order[N];
+        uint8_t used = 0;
+        for (uint8_t i = 0; i < N; ++i) {
+            if (_pulses[i] == 0) continue;
+            addEdge(edges, count, SERVO_MUX_START, _ports[i], _masks[i], true);
+            // Insertion sort by pulse width, N is small
+            uint8_t pos = used++;
+            while (pos > 0 && _pulses[order[pos - 1]] > _pulses[i]) {
+                order[pos] = order[pos - 1];
+                --pos;
+            }
+            order[pos] = i;
+        }
+        for (uint8_t i = 0; i < used; ++i) {
+            uint8_t channel = order[i];
+            addEdge(edges, count, SERVO_MUX_START + _pulses[channel], _ports[channel], _masks[channel], false);
+        }
+        if (count == 0) {
+            // Nothing to drive, keep the interrupt ticking once per period
+            edges[count++] = Edge{SERVO_MUX_START, 0, 0, true};
+        }
+        _counts[target] = count;
+
+        cli();
+        _pending = true;
+        sei();
+    }
+
+    // Worst delay of an edge behind its schedule, in timer ticks of SERVO_MUX_TICKS_PER_MS.
+    // One tick comes from the spin itself, anything more is latency added by other interrupts
+    uint16_t maxLateTicks() const {
+        InterruptLock lock;
+        return _max_late_ticks;
+    }
+
+    // Time from the start of the interrupt body to its return, including the early spin, last and worst case
+    uint16_t lastInterruptTicks() const {
+        InterruptLock lock;
+        return _last_interrupt_ticks;
+    }
+
+    uint16_t maxInterruptTicks() const {
+        InterruptLock lock;
+        return _max_interrupt_ticks;
+    }
+
+    void resetStats() {
+        InterruptLock lock;
+        _max_late_ticks = 0;
+        _max_interrupt_ticks = 0;
+    }
+
+    // Body of the compare A interrupt
+    void onCompare() {
+        const uint16_t start = readShort(CTCNT1);
+        const Edge* edges = _schedule[_active];
+        uint8_t count = _counts[_active];
+        uint8_t i = _index;
+        while (true) {
+            const Edge& edge = edges[i];
+            uint16_t now;
+            while (static_cast<int16_t>((now = readShort(CTCNT1)) - edge.time) < 0) {}
+            if (edge.mask != 0) {
+                vol_ptr port = reinterpret_cast<vol_ptr>(edge.port);
+                if (edge.rising) {
+                    *port = *port | edge.mask;
+                } else {
+                    *port = *port & ~edge.mask;
+                }
+            }
+            // Bookkeeping after the write keeps it out of the edge timing
+            uint16_t late = now - edge.time;
+            if (late > _max_late_ticks) {
+                _max_late_ticks = late;
+            }
+            ++i;
+            if (i == count) {
+                // End of the pulses, the next interrupt starts the next period
+                if (_pending) {
+                    _active = _active ^ 1;
+                    _pending = false;
+                    edges = _schedule[_active];
+                }
+                _index = 0;
+                setCompare(edges[0].time);
+                recordInterrupt(start);
+                return;
+            }
+            if (static_cast<int16_t>(edges[i].time - readShort(CTCNT1)) > static_cast<int16_t>(SERVO_MUX_MIN_GAP)) {
+                _index = i;
+                setCompare(edges[i].time);
+                recordInterrupt(start);
+                return;
+            }
+        }
+    }
+};
+
+// The servo pins are claimed separately, PinClaim<CPD4, CPD7>. Both compare channels, Timer1 runs in CTC mode
+struct ServoMuxClaim : Claim<Resource::TIMER_1_A, Resource::TIMER_1_B, Resource::VECTOR_TIMER1_COMPA> {};
+
+// Binds the compare A interrupt to a ServoMux instance
+#define HAL_SERVO_MUX_ISR(mux) \
+    ISR(TIMER1_COMPA_vect) { mux.onCompare(); }
+
+}  // namespace hal
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "spibus.hpp"
+
+namespace hal {
+
+/*
+ * SPI master (15_SPI) with queued transfers driven by the SPI STC interrupt, one interrupt per byte.
+ * Every device has its own chip select, mode and clock, which are applied when its transfer starts.
+ * Transfers are owned by the caller and have to stay alive until done, the queue only keeps pointers to them.
+ *
+ *     constexpr SPIDevice sensor(CPB1, SPISettings(1000000, SPIMode::MODE3));
+ *     uint8_t command[4] = {0x80 | 0x0F};
+ *     uint8_t reply[4];
+ *     SPITransfer transfer(sensor, command, reply, 4);
+ *
+ *     SPI.begin();
+ *     SPI.submit(transfer);
+ *     ...
+ *     if (transfer.done) { ... }
+ *
+ * Bulk data goes through the blocking transfers, which take no interrupt per byte:
+ *
+ *     SPI.beginTransaction(card);
+ *     SPI.send(block, 512);
+ *     SPI.endTransaction(card);
+ */
+
+constexpr uintptr_t CSPCR = 0x4C;
+constexpr uintptr_t CSPSR = 0x4D;
+constexpr uintptr_t CSPDR = 0x4E;
+
+struct SPITransfer;
+using SPICallback = void (*)(SPITransfer&);
+
+struct SPITransfer {
+    const SPIDevice* device;
+    // Without data to send 0xFF goes out, without a receive buffer the replies are dropped
+    const uint8_t* tx;
+    uint8_t* rx;
+    uint16_t length;
+    // Called from the interrupt once the chip select is released
+    SPICallback callback;
+    volatile bool done = true;
+
+    constexpr SPITransfer(const SPIDevice& dev, const uint8_t* tx_data, uint8_t* rx_data, uint16_t len,
+                          SPICallback on_done = nullptr)
+        : device(&dev), tx(tx_data), rx(rx_data), length(len), callback(on_done) {}
+};
+
+template <uint8_t QUEUE_SIZE = 8>
+class SPIMaster {
+    SPITransfer* _queue[QUEUE_SIZE] = {};
+    volatile uint8_t _head = 0;
+    volatile uint8_t _count = 0;
+    // Byte of the running transfer, only touched with the SPI interrupt off or from inside it
+    uint16_t _index = 0;
+    volatile bool _running = false;
+    volatile uint8_t _overruns = 0;
+
+    void start(SPITransfer& transfer) {
+        const SPIDevice& device = *transfer.device;
+        setByte(CSPCR, device.settings.control | bit(SPISettings::CSPIE));
+        setByte(CSPSR, device.settings.status);
+        device.select();
+        _index = 0;
+        _running = true;
+        setByte(CSPDR, transfer.tx ? transfer.tx[0] : 0xFF);
+    }
+
+    // The callers prepare the next byte before waiting
+    static void wait() {
+        while (!readBit(CSPSR, SPISettings::CSPIF)) {}
+    }
+
+    // Runs the next queued transfer, if there is one
+    void next() {
+        if (_count == 0) {
+            _running = false;
+            setByte(CSPCR, readByte(CSPCR) & ~bit(SPISettings::CSPIE));
+            return;
+        }
+        start(*_queue[_head]);
+    }
+
+   public:
+    // PB2 (SS) has to stay an output, as an input pulled low it would switch the SPI to slave mode
+    void begin() const {
+        pinMode(CPB2, OUTPUT);
+        CPB2.digitalWrite(true);
+        pinMode(CPB3, OUTPUT);
+        pinMode(CPB5, OUTPUT);
+        pinMode(CPB4, INPUT);
+        setByte(CSPCR, bit(SPISettings::CSPE) | bit(SPISettings::CMSTR));
+    }
+
+    void end() const { setByte(CSPCR, 0); }
+
+    // Chip select high before anything else, so devices on the bus do not see the first clocks
+    void attach(const SPIDevice& device) const {
+        device.deselect();
+        pinMode(device.chip_select, OUTPUT);
+        device.deselect();
+    }
+
+    // False when the queue is full, a transfer must not be submitted again before it is done
+    bool submit(SPITransfer& transfer) {
+        if (transfer.length == 0) {
+            transfer.done = true;
+            return true;
+        }
+        InterruptLock lock;
+        if (_count == QUEUE_SIZE) {
+            _overruns = _overruns + 1;
+            return false;
+        }
+        transfer.done = false;
+        _queue[(_head + _count) % QUEUE_SIZE] = &transfer;
+        _count = _count + 1;
+        if (!_running) {
+            start(*_queue[_head]);
+        }
+        return true;
+    }
+
+    bool busy() const { return _running; }
+
+    uint8_t queued() const { return _count; }
+
+    // Submissions rejected because the queue was full
+    uint8_t overruns() const { return _overruns; }
+
+    // Waits for every queued transfer
+    void flush() const {
+        while (_running) {}
+    }
+
+    // Takes the bus for blocking transfers, queued transfers wait until endTransaction()
+    void beginTransaction(const SPIDevice& device) {
+        while (true) {
+            InterruptLock lock;
+            if (!_running) {
+                _running = true;
+                break;
+            }
+        }
+        setByte(CSPCR, device.settings.control);
+        setByte(CSPSR, device.settings.status);
+        device.select();
+    }
+
+    void endTransaction(const SPIDevice& device) {
+        device.deselect();
+        InterruptLock lock;
+        next();
+    }
+
+    uint8_t transfer(uint8_t data) const {
+        setByte(CSPDR, data);
+        wait();
+        return readByte(CSPDR);
+    }
+
+    /*
+     * Block transfers inside a transaction. The next byte is loaded while the current one shifts,
+     * after SPIF only the SPDR write is left before the next byte starts.
+     * Receiving is double buffered, the reply is read after the next byte already started.
+     */
+    void transfer(const uint8_t* tx, uint8_t* rx, uint16_t length) const {
+        if (length == 0) return;
+        setByte(CSPDR, *tx++);
+        while (--length) {
+            uint8_t out = *tx++;
+            wait();
+            setByte(CSPDR, out);
+            *rx++ = readByte(CSPDR);
+        }
+        wait();
+        *rx = readByte(CSPDR);
+    }
+
+    void send(const uint8_t* tx, uint16_t length) const {
+        if (length == 0) return;
+        setByte(CSPDR, *tx++);
+        while (--length) {
+            uint8_t out = *tx++;
+            wait();
+            setByte(CSPDR, out);
+        }
+        wait();
+        // Reading SPDR after SPIF clears the flag
+        readByte(CSPDR);
+    }
+
+    // Clocks FILL out, 0xFF keeps MOSI high as SD cards expect
+    void receive(uint8_t* rx, uint16_t length, uint8_t fill = 0xFF) const {
+        if (length == 0) return;
+        setByte(CSPDR, fill);
+        while (--length) {
+            wait();
+            setByte(CSPDR, fill);
+            *rx++ = readByte(CSPDR);
+        }
+        wait();
+        *rx = readByte(CSPDR);
+    }
+
+    // Body of the SPI STC interrupt
+    void onTransferComplete() {
+        SPITransfer& transfer = *_queue[_head];
+        uint8_t received = readByte(CSPDR);
+        if (transfer.rx) {
+            transfer.rx[_index] = received;
+        }
+        ++_index;
+        if (_index < transfer.length) {
+            setByte(CSPDR, transfer.tx ? transfer.tx[_index] : 0xFF);
+            return;
+        }
+
+        transfer.device->deselect();
+        _head = (_head + 1) % QUEUE_SIZE;
+        _count = _count - 1;
+        transfer.done = true;
+        if (transfer.callback) {
+            transfer.callback(transfer);
+        }
+        next();
+    }
+};
+
+SPIMaster<> SPI;
+
+// SS, MOSI, MISO and SCK. begin() makes SS an output, it can still select a device on the bus,
+// other chip selects are claimed separately
+struct SPIClaim : Claim<Resource::PIN_B2, Resource::PIN_B3, Resource::PIN_B4, Resource::PIN_B5, Resource::UNIT_SPI,
+                        Resource::VECTOR_SPI_STC> {};
+
+ISR(SPI_STC_vect) { SPI.onTransferComplete(); }
+
+}  // namespace hal
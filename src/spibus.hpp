@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "pins.hpp"
+
+namespace hal {
+
+// Devices and their bus settings, shared by the SPI unit, USART SPI and SoftSPI, without any interrupt
+
+// Clock polarity and phase as the CPOL and CPHA bits of SPCR
+enum class SPIMode : uint8_t {
+    MODE0 = 0b0000,
+    MODE1 = 0b0100,
+    MODE2 = 0b1000,
+    MODE3 = 0b1100,
+};
+
+enum class SPIBitOrder : uint8_t {
+    MSB_FIRST = 0,
+    LSB_FIRST = 1 << 5,
+};
+
+// Register values of one device, the clock is the fastest one not above the requested frequency
+struct SPISettings {
+    uint8_t control;
+    uint8_t status;
+
+    static constexpr uint8_t CSPIE = 7;
+    static constexpr uint8_t CSPE = 6;
+    static constexpr uint8_t CMSTR = 4;
+    static constexpr uint8_t CSPI2X = 0;
+    static constexpr uint8_t CSPIF = 7;
+
+    consteval SPISettings(uint32_t clock, SPIMode mode = SPIMode::MODE0,
+                          SPIBitOrder order = SPIBitOrder::MSB_FIRST) : control(0), status(0) {
+        // Dividers 2 to 128, SPR1:0 picks 4, 16, 64 or 128 and SPI2X halves the first three
+        uint8_t shift = 1;
+        while (shift < 7 && (F_CPU >> shift) > clock) {
+            ++shift;
+        }
+        bool doubled = shift % 2 == 1 && shift < 7;
+        uint8_t spr = shift == 7 ? 0b11 : (shift - 1) / 2;
+        control = (1 << CSPE) | (1 << CMSTR) | static_cast<uint8_t>(mode) | static_cast<uint8_t>(order) | spr;
+        status = doubled ? 1 << CSPI2X : 0;
+    }
+
+    constexpr uint32_t frequency() const {
+        uint8_t spr = control & 0b11;
+        uint8_t shift = spr == 0b11 ? 7 : 2 * spr + 2;
+        return F_CPU >> (status ? shift - 1 : shift);
+    }
+};
+
+struct SPIDevice {
+    DigitalPin chip_select;
+    SPISettings settings;
+
+    constexpr SPIDevice(const DigitalPin& cs, const SPISettings& spi_settings)
+        : chip_select(cs), settings(spi_settings) {}
+
+    void select() const { chip_select.digitalWrite(false); }
+
+    void deselect() const { chip_select.digitalWrite(true); }
+};
+
+}  // namespace hal
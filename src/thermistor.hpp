@@ -0,0 +1,111 @@
+#pragma once
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "constmath.hpp"
+#include "fixed.hpp"
+
+namespace hal {
+
+/*
+ * NTC thermistor in a voltage divider, converted to temperature through a table generated at compile time.
+ * The table holds the temperature every 2^STEP_BITS ADC codes and lookups interpolate linearly in between,
+ * which is two flash reads and one multiplication per conversion.
+ *
+ * Thermistor keeps the table in flash, lookups only go through it:
+ *
+ *     using NTC = hal::Thermistor<hal::ThermistorTable<>::beta(10000, 10000, 25, 3950)>;
+ *     hal::Q8_8 celsius = NTC::temperature(hal::analogRead(hal::CADC1));
+ */
+
+enum class ThermistorWiring {
+    // Thermistor between VCC and the pin, series resistor to ground
+    NTC_TO_VCC,
+    // Series resistor between VCC and the pin, thermistor to ground
+    NTC_TO_GROUND,
+};
+
+template <uint8_t STEP_BITS = 5>
+class ThermistorTable {
+    static_assert(STEP_BITS >= 2 && STEP_BITS <= 8, "Index and offset have to fit into a byte");
+
+    static constexpr uint16_t ADC_CODES = 1024;
+    static constexpr uint16_t STEP = 1 << STEP_BITS;
+    static constexpr uint16_t ENTRIES = ADC_CODES / STEP + 1;
+    static constexpr double KELVIN = 273.15;
+
+    struct Model {
+        double series;
+        ThermistorWiring wiring;
+        // 1 / T = a + b * ln(R) + c * ln(R)^3
+        double a;
+        double b;
+        double c;
+    };
+
+    static consteval int16_t toCelsius(const Model& model, double code) {
+        // Ends of the range are open circuit or short, the temperature is clamped there anyway
+        if (code <= 0.0) code = 0.001;
+        if (code >= ADC_CODES) code = ADC_CODES - 0.001;
+        double ratio = code / (ADC_CODES - code);
+        double resistance =
+            model.wiring == ThermistorWiring::NTC_TO_GROUND ? model.series * ratio : model.series / ratio;
+        double ln = constLn(resistance);
+        double inverse = model.a + model.b * ln + model.c * ln * ln * ln;
+        // The models break down on a short, that is as hot as it gets
+        if (inverse <= 0.0) return Q8_8::max().raw();
+        double celsius = 1.0 / inverse - KELVIN;
+        // Q8.8 has to hold it
+        double raw = celsius * Q8_8::ONE;
+        if (raw > Q8_8::max().raw()) return Q8_8::max().raw();
+        if (raw < Q8_8::min().raw()) return Q8_8::min().raw();
+        return static_cast<int16_t>(raw < 0 ? raw - 0.5 : raw + 0.5);
+    }
+
+    static consteval ThermistorTable generate(const Model& model) {
+        ThermistorTable table;
+        for (uint16_t i = 0; i < ENTRIES; ++i) {
+            table.entries[i] = toCelsius(model, static_cast<double>(i) * STEP);
+        }
+        return table;
+    }
+
+   public:
+    static constexpr uint8_t BITS = STEP_BITS;
+
+    // Temperature every STEP ADC codes in Q8.8, public only so the table can be a template argument
+    int16_t entries[ENTRIES] = {};
+
+    // Beta model, thermistor has resistance R0 at temperature T0 in Celsius
+    static consteval ThermistorTable beta(double series, double r0, double t0, double beta,
+                                          ThermistorWiring wiring = ThermistorWiring::NTC_TO_VCC) {
+        // 1 / T = 1 / T0 + (ln(R) - ln(R0)) / B
+        double b = 1.0 / beta;
+        return generate(Model{series, wiring, 1.0 / (t0 + KELVIN) - constLn(r0) * b, b, 0.0});
+    }
+
+    // Steinhart-Hart coefficients as given by the datasheet
+    static consteval ThermistorTable steinhartHart(double series, double a, double b, double c,
+                                                   ThermistorWiring wiring = ThermistorWiring::NTC_TO_VCC) {
+        return generate(Model{series, wiring, a, b, c});
+    }
+};
+
+// Lookups in a table from ThermistorTable, the only copy of it is in flash
+template <auto TABLE>
+struct Thermistor {
+    static constexpr uint8_t STEP_BITS = decltype(TABLE)::BITS;
+    static constexpr decltype(TABLE) FLASH PROGMEM = TABLE;
+
+    static Q8_8 temperature(uint16_t adc) {
+        uint8_t index = adc >> STEP_BITS;
+        uint8_t offset = adc & ((1 << STEP_BITS) - 1);
+        int16_t low = pgm_read_word(&FLASH.entries[index]);
+        int16_t high = pgm_read_word(&FLASH.entries[index + 1]);
+        int32_t delta = (static_cast<int32_t>(high) - low) * offset;
+        return Q8_8::fromRaw(low + static_cast<int16_t>(delta >> STEP_BITS));
+    }
+};
+
+}  // namespace hal
@@ -3,6 +3,7 @@
 #include <avr/interrupt.h>
 #include "bitops.hpp"
 #include "pins.hpp"
+#include "resources.hpp"
 
 namespace hal {
     
@@ -28,6 +29,7 @@ ISR(TIMER0_OVF_vect) {
 }
 
 constexpr uintptr_t CTIMSK0 = 0x6E;
+constexpr uintptr_t CTCNT0 = 0x46;
 
 uint32_t millis() {
     cli();
@@ -36,6 +38,9 @@ uint32_t millis() {
     return local_time;
 }
 
+// millis(), micros() and delay(), setupTimer() runs Timer0 through the OC0A pin setup, so PWM on CPD5 fights with it
+struct TimeBaseClaim : Claim<Resource::TIMER_0, Resource::PIN_D6, Resource::VECTOR_TIMER0_OVF> {};
+
 void setupTimer() {
     // Somehow setupPWM works, but the commented code which should
     // do the same thing does not, go figure
@@ -66,11 +71,26 @@ uint32_t micros() {
     cli();
     auto local_overflows = overflows;
     sei();
-    const uintptr_t CTCNT0 = 0x46;
     auto ticks = readByte(CTCNT0);
     return (local_overflows * 256 + ticks) * 4;
 }
 
+constexpr uintptr_t CTIFR0 = 0x35;
+// Length of one Timer0 tick in nanoseconds
+constexpr uint32_t TIMER0_TICK_NS = 64 * 1000000000ULL / F_CPU;
+
+// Timer0 ticks since setupTimer(), for timestamps taken inside interrupts with interrupts disabled
+uint32_t timer0Ticks() {
+    uint8_t ticks = readByte(CTCNT0);
+    uint32_t local_overflows = overflows;
+    // The counter wrapped, but the overflow interrupt did not run yet
+    const auto CTOV0 = 0;
+    if (readBit(CTIFR0, CTOV0) && ticks < 255) {
+        ++local_overflows;
+    }
+    return (local_overflows << 8) | ticks;
+}
+
 bool in_range(uint32_t start, uint32_t end, uint32_t val) {
     return val >= start && val <= end;
 }
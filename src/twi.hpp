@@ -0,0 +1,290 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "twibus.hpp"
+
+namespace hal {
+
+/*
+ * I2C master (16_I2C) driven by the TWI interrupt, the CPU only handles one interrupt per byte.
+ * Transactions are writes, reads or a write followed by a read after a repeated start,
+ * as most sensors and EEPROMs want for register reads. They are owned by the caller and queued by pointer.
+ * Slaves stretching the clock simply hold the state machine, the hardware waits for SCL.
+ *
+ *     uint8_t reg = 0x3B;
+ *     uint8_t sample[6];
+ *     auto read = TWITransaction::writeRead(0x68, &reg, 1, sample, 6);
+ *
+ *     TWI.begin();
+ *     TWI.submit(read);
+ *     ...
+ *     if (read.done && read.result == TWIResult::OK) { ... }
+ */
+
+template <uint8_t QUEUE_SIZE = 8, uint8_t ARBITRATION_RETRIES = 3>
+class TWIMaster {
+    TWITransaction* _queue[QUEUE_SIZE] = {};
+    volatile uint8_t _head = 0;
+    volatile uint8_t _count = 0;
+    volatile bool _running = false;
+    // State of the running transaction, only touched from the interrupt or with it off
+    uint8_t _index = 0;
+    bool _reading = false;
+    uint8_t _retries = 0;
+
+    volatile uint8_t _nacks = 0;
+    volatile uint8_t _arbitration_losses = 0;
+    volatile uint8_t _bus_errors = 0;
+
+    static void control(uint8_t bits) { setByte(CTWCR, bits | bit(CTWINT) | bit(CTWEN) | bit(CTWIE)); }
+
+    void start() {
+        // The STOP ending the previous transaction may still be on the bus, writing TWCR now would drop it
+        while (readBit(CTWCR, CTWSTO)) {}
+        _index = 0;
+        _reading = _queue[_head]->tx_length == 0 && _queue[_head]->rx_length > 0;
+        _running = true;
+        control(bit(CTWSTA));
+    }
+
+    TWITransaction& pop() {
+        TWITransaction& transaction = *_queue[_head];
+        _head = (_head + 1) % QUEUE_SIZE;
+        _count = _count - 1;
+        _retries = 0;
+        return transaction;
+    }
+
+    static void notify(TWITransaction& transaction, TWIResult result) {
+        transaction.result = result;
+        transaction.done = true;
+        if (transaction.callback) {
+            transaction.callback(transaction);
+        }
+    }
+
+    // Stop, and a new start right behind it when more is queued, as the master the hardware sends them in order.
+    // After a lost arbitration the TWI is no master any more and only lets go of the bus, the start waits for it
+    // to become free. After a bus error the stop only resets the TWI, the start follows once that is done
+    void finish(TWIResult result) {
+        TWITransaction& transaction = pop();
+        bool more = _count > 0;
+        if (more) {
+            _index = 0;
+            _reading = _queue[_head]->tx_length == 0 && _queue[_head]->rx_length > 0;
+        } else {
+            _running = false;
+        }
+        if (result == TWIResult::ARBITRATION_LOST) {
+            if (more) {
+                control(bit(CTWSTA));
+            } else {
+                setByte(CTWCR, bit(CTWINT) | bit(CTWEN));
+            }
+        } else if (result == TWIResult::BUS_ERROR) {
+            setByte(CTWCR, bit(CTWINT) | bit(CTWEN) | bit(CTWSTO));
+            if (more) {
+                while (readBit(CTWCR, CTWSTO)) {}
+                control(bit(CTWSTA));
+            }
+        } else if (more) {
+            control(bit(CTWSTO) | bit(CTWSTA));
+        } else {
+            setByte(CTWCR, bit(CTWINT) | bit(CTWEN) | bit(CTWSTO));
+        }
+        notify(transaction, result);
+    }
+
+    // Open drain by hand while the TWI is off, low drives the line, released the pull-ups take it high
+    static void pullLine(const DigitalPin& pin) {
+        pin.digitalWrite(false);
+        setBit(pin.modeAddress(), true, pin.position());
+    }
+
+    static void releaseLine(const DigitalPin& pin, bool pull_up) {
+        setBit(pin.modeAddress(), false, pin.position());
+        pin.digitalWrite(pull_up);
+    }
+
+    // A slave interrupted in the middle of a read holds SDA low until it has clocked out its byte,
+    // up to 9 clocks at 100 kHz free it, the STOP afterwards returns every slave to idle
+    static void recoverBus() {
+        constexpr uint32_t HALF = F_CPU / 200000;
+        const bool pull_ups = readBit(CPC4.outputAddress(), CPC4.position());
+        releaseLine(CPC4, pull_ups);
+        releaseLine(CPC5, pull_ups);
+        __builtin_avr_delay_cycles(HALF);
+        for (uint8_t i = 0; i < 9 && !CPC4.digitalRead(); ++i) {
+            pullLine(CPC5);
+            __builtin_avr_delay_cycles(HALF);
+            releaseLine(CPC5, pull_ups);
+            __builtin_avr_delay_cycles(HALF);
+        }
+        // STOP, SDA rises while SCL is high
+        pullLine(CPC5);
+        pullLine(CPC4);
+        __builtin_avr_delay_cycles(HALF);
+        releaseLine(CPC5, pull_ups);
+        __builtin_avr_delay_cycles(HALF);
+        releaseLine(CPC4, pull_ups);
+        __builtin_avr_delay_cycles(HALF);
+    }
+
+    void count(volatile uint8_t& counter) {
+        if (counter < 0xFF) {
+            counter = counter + 1;
+        }
+    }
+
+   public:
+    // The internal pull-ups are weak, buses longer than a few centimeters need external ones
+    void begin(const TWIClock& clock = TWI_FAST, bool pull_ups = true) const {
+        CPC4.digitalWrite(pull_ups);
+        CPC5.digitalWrite(pull_ups);
+        setByte(CTWBR, clock.bit_rate);
+        setByte(CTWSR, clock.prescaler);
+        setByte(CTWCR, bit(CTWEN));
+    }
+
+    void end() const { setByte(CTWCR, 0); }
+
+    // False when the queue is full, a transaction must not be submitted again before it is done
+    bool submit(TWITransaction& transaction) {
+        InterruptLock lock;
+        if (_count == QUEUE_SIZE) return false;
+        transaction.result = TWIResult::PENDING;
+        transaction.done = false;
+        _queue[(_head + _count) % QUEUE_SIZE] = &transaction;
+        _count = _count + 1;
+        if (!_running) {
+            start();
+        }
+        return true;
+    }
+
+    bool busy() const { return _running; }
+
+    // Waits for every queued transaction
+    void flush() const {
+        while (_running) {}
+    }
+
+    // Runs one transaction and waits for it
+    TWIResult run(TWITransaction& transaction) {
+        while (!submit(transaction)) {}
+        while (!transaction.done) {}
+        return transaction.result;
+    }
+
+    // Address and data bytes refused by slaves
+    uint8_t nacks() const { return _nacks; }
+
+    uint8_t arbitrationLosses() const { return _arbitration_losses; }
+
+    uint8_t busErrors() const { return _bus_errors; }
+
+    void resetCounters() {
+        InterruptLock lock;
+        _nacks = 0;
+        _arbitration_losses = 0;
+        _bus_errors = 0;
+    }
+
+    // For a bus stuck by a slave holding SDA, fails everything queued, clocks the slave free with the TWI off,
+    // sends a STOP by hand and restarts the TWI. Takes about 100 us
+    void reset() {
+        InterruptLock lock;
+        setByte(CTWCR, 0);
+        _running = false;
+        while (_count > 0) {
+            notify(pop(), TWIResult::BUS_ERROR);
+        }
+        recoverBus();
+        setByte(CTWCR, bit(CTWEN));
+    }
+
+    // Body of the TWI interrupt
+    void onInterrupt() {
+        TWITransaction& transaction = *_queue[_head];
+        switch (twiStatus()) {
+            case TWIStatus::START:
+            case TWIStatus::REPEATED_START:
+                setByte(CTWDR, (transaction.address << 1) | (_reading ? 1 : 0));
+                control(0);
+                break;
+
+            case TWIStatus::ADDRESS_WRITE_ACK:
+            case TWIStatus::DATA_WRITE_ACK:
+                if (_index < transaction.tx_length) {
+                    setByte(CTWDR, transaction.tx[_index++]);
+                    control(0);
+                } else if (transaction.rx_length > 0) {
+                    _index = 0;
+                    _reading = true;
+                    control(bit(CTWSTA));
+                } else {
+                    finish(TWIResult::OK);
+                }
+                break;
+
+            case TWIStatus::ADDRESS_WRITE_NACK:
+            case TWIStatus::ADDRESS_READ_NACK:
+                count(_nacks);
+                finish(TWIResult::ADDRESS_NACK);
+                break;
+
+            case TWIStatus::DATA_WRITE_NACK:
+                count(_nacks);
+                finish(TWIResult::DATA_NACK);
+                break;
+
+            case TWIStatus::ARBITRATION_LOST:
+                count(_arbitration_losses);
+                if (_retries < ARBITRATION_RETRIES) {
+                    ++_retries;
+                    // Start again from the top once the bus is free
+                    _index = 0;
+                    _reading = transaction.tx_length == 0 && transaction.rx_length > 0;
+                    control(bit(CTWSTA));
+                } else {
+                    finish(TWIResult::ARBITRATION_LOST);
+                }
+                break;
+
+            case TWIStatus::ADDRESS_READ_ACK:
+                // The last byte is answered with a NACK, a single byte read gets it right away
+                control(transaction.rx_length > 1 ? bit(CTWEA) : 0);
+                break;
+
+            case TWIStatus::DATA_READ_ACK:
+                transaction.rx[_index++] = readByte(CTWDR);
+                control(_index + 1 < transaction.rx_length ? bit(CTWEA) : 0);
+                break;
+
+            case TWIStatus::DATA_READ_NACK:
+                transaction.rx[_index++] = readByte(CTWDR);
+                finish(TWIResult::OK);
+                break;
+
+            default:
+                count(_bus_errors);
+                finish(TWIResult::BUS_ERROR);
+                break;
+        }
+    }
+};
+
+TWIMaster<> TWI;
+
+// SDA and SCL
+struct TWIClaim : Claim<Resource::PIN_C4, Resource::PIN_C5, Resource::UNIT_TWI, Resource::VECTOR_TWI> {};
+
+ISR(TWI_vect) { TWI.onInterrupt(); }
+
+}  // namespace hal
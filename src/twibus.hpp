@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "bitops.hpp"
+
+namespace hal {
+
+// TWI registers, status codes and transactions, shared by the master, the slave and SoftI2C
+constexpr uintptr_t CTWBR = 0xB8;
+constexpr uintptr_t CTWSR = 0xB9;
+constexpr uintptr_t CTWAR = 0xBA;
+constexpr uintptr_t CTWDR = 0xBB;
+constexpr uintptr_t CTWCR = 0xBC;
+constexpr uintptr_t CTWAMR = 0xBD;
+
+constexpr uint8_t CTWINT = 7;
+constexpr uint8_t CTWEA = 6;
+constexpr uint8_t CTWSTA = 5;
+constexpr uint8_t CTWSTO = 4;
+constexpr uint8_t CTWEN = 2;
+constexpr uint8_t CTWIE = 0;
+
+// Status codes in TWSR with the prescaler bits masked off
+enum class TWIStatus : uint8_t {
+    BUS_ERROR = 0x00,
+    START = 0x08,
+    REPEATED_START = 0x10,
+    ADDRESS_WRITE_ACK = 0x18,
+    ADDRESS_WRITE_NACK = 0x20,
+    DATA_WRITE_ACK = 0x28,
+    DATA_WRITE_NACK = 0x30,
+    ARBITRATION_LOST = 0x38,
+    ADDRESS_READ_ACK = 0x40,
+    ADDRESS_READ_NACK = 0x48,
+    DATA_READ_ACK = 0x50,
+    DATA_READ_NACK = 0x58,
+    // Slave receiver
+    OWN_WRITE = 0x60,
+    OWN_WRITE_ARBITRATION_LOST = 0x68,
+    GENERAL_CALL = 0x70,
+    GENERAL_CALL_ARBITRATION_LOST = 0x78,
+    RECEIVED_ACK = 0x80,
+    RECEIVED_NACK = 0x88,
+    GENERAL_CALL_RECEIVED_ACK = 0x90,
+    GENERAL_CALL_RECEIVED_NACK = 0x98,
+    STOP = 0xA0,
+    // Slave transmitter
+    OWN_READ = 0xA8,
+    OWN_READ_ARBITRATION_LOST = 0xB0,
+    SENT_ACK = 0xB8,
+    SENT_NACK = 0xC0,
+    LAST_SENT_ACK = 0xC8,
+};
+
+inline TWIStatus twiStatus() { return static_cast<TWIStatus>(readByte(CTWSR) & 0xF8); }
+
+// SCL is F_CPU / (16 + 2 * TWBR * 4^TWPS)
+struct TWIClock {
+    uint8_t bit_rate;
+    uint8_t prescaler;
+
+    static consteval TWIClock forFrequency(uint32_t frequency) {
+        for (uint8_t prescaler = 0; prescaler < 4; ++prescaler) {
+            uint32_t divider = 2 * (1UL << (2 * prescaler));
+            uint32_t bit_rate = (F_CPU / frequency - 16 + divider - 1) / divider;
+            if (bit_rate <= 0xFF) {
+                return TWIClock{static_cast<uint8_t>(bit_rate), prescaler};
+            }
+        }
+        return TWIClock{0xFF, 0b11};
+    }
+
+    constexpr uint32_t frequency() const {
+        return F_CPU / (16 + 2UL * bit_rate * (1UL << (2 * prescaler)));
+    }
+};
+
+constexpr TWIClock TWI_STANDARD = TWIClock::forFrequency(100000);
+constexpr TWIClock TWI_FAST = TWIClock::forFrequency(400000);
+
+enum class TWIResult : uint8_t {
+    PENDING,
+    OK,
+    // Nobody answered the address
+    ADDRESS_NACK,
+    // The slave refused a data byte
+    DATA_NACK,
+    // Another master kept winning, given up after a few retries
+    ARBITRATION_LOST,
+    // Illegal start or stop on the bus, or reset() while running
+    BUS_ERROR,
+};
+
+struct TWITransaction;
+using TWICallback = void (*)(TWITransaction&);
+
+struct TWITransaction {
+    // 7 bit address
+    uint8_t address;
+    const uint8_t* tx;
+    uint8_t tx_length;
+    uint8_t* rx;
+    uint8_t rx_length;
+    // Called from the interrupt after the stop condition was requested
+    TWICallback callback;
+    volatile TWIResult result = TWIResult::OK;
+    volatile bool done = true;
+
+    constexpr TWITransaction(uint8_t addr, const uint8_t* tx_data, uint8_t tx_len, uint8_t* rx_data, uint8_t rx_len,
+                             TWICallback on_done = nullptr)
+        : address(addr), tx(tx_data), tx_length(tx_len), rx(rx_data), rx_length(rx_len), callback(on_done) {}
+
+    static TWITransaction write(uint8_t addr, const uint8_t* data, uint8_t length, TWICallback on_done = nullptr) {
+        return TWITransaction(addr, data, length, nullptr, 0, on_done);
+    }
+
+    static TWITransaction read(uint8_t addr, uint8_t* data, uint8_t length, TWICallback on_done = nullptr) {
+        return TWITransaction(addr, nullptr, 0, data, length, on_done);
+    }
+
+    // Register reads, the read follows a repeated start without releasing the bus
+    static TWITransaction writeRead(uint8_t addr, const uint8_t* tx_data, uint8_t tx_len, uint8_t* rx_data,
+                                    uint8_t rx_len, TWICallback on_done = nullptr) {
+        return TWITransaction(addr, tx_data, tx_len, rx_data, rx_len, on_done);
+    }
+};
+
+}  // namespace hal
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "atomic.hpp"
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "twibus.hpp"
+
+namespace hal {
+
+/*
+ * I2C slave exposing a register map, served completely from the TWI interrupt.
+ * The first byte of a write selects the register, further bytes are written from there on,
+ * reads continue from the selected register, the pointer increments after every byte either way.
+ * Registers past the end of the map read as 0xFF and ignore writes.
+ *
+ * The map is a table in flash, the index is the register number:
+ *
+ *     volatile uint8_t speed;
+ *     uint8_t readStatus() { ... }
+ *     constexpr TWIRegister REGISTERS[] PROGMEM = {
+ *         {readStatus, nullptr},
+ *         {readVariable<speed>, writeVariable<speed>},
+ *     };
+ *     TWISlave<REGISTERS> slave;
+ *     HAL_TWI_SLAVE_ISR(slave)
+ *
+ *     slave.begin(0x42);
+ *
+ * The slave stretches SCL from the address or data byte until the interrupt is done with it,
+ * callbacks run inside that window and should stay short. TWISlave<REGISTERS, true> measures the window
+ * in CPU cycles, 62.5 ns at 16 MHz, from TWINT to the release. It runs Timer1 at the full clock for that,
+ * so the servo drivers cannot run next to it. The interrupt entry before the first timer read is counted
+ * as a fixed TWI_SLAVE_ENTRY_CYCLES, time spent with interrupts off elsewhere before it is not seen.
+ */
+
+// Interrupt response, the vector jump and the prologue saving the registers the callbacks may clobber
+constexpr uint8_t TWI_SLAVE_ENTRY_CYCLES = 40;
+
+using TWIRegisterRead = uint8_t (*)();
+using TWIRegisterWrite = void (*)(uint8_t);
+
+struct TWIRegister {
+    // Without a read callback the register reads as 0xFF
+    TWIRegisterRead read;
+    // Without a write callback the register is read-only
+    TWIRegisterWrite write;
+};
+
+// Registers backed by a plain variable
+template <volatile uint8_t& VALUE>
+uint8_t readVariable() {
+    return VALUE;
+}
+
+template <volatile uint8_t& VALUE>
+void writeVariable(uint8_t val) {
+    VALUE = val;
+}
+
+template <const auto& MAP, bool TIMED = false>
+class TWISlave {
+    static constexpr uint8_t COUNT = sizeof(MAP) / sizeof(MAP[0]);
+    static_assert(COUNT > 0 && COUNT < 0xFF, "Register numbers are one byte");
+
+    static constexpr uint8_t CTWGCE = 0;
+
+    uint8_t _pointer = 0;
+    // The next received byte is the register number
+    bool _select = false;
+    volatile uint16_t _last_response_cycles = 0;
+    volatile uint16_t _max_response_cycles = 0;
+
+    // Clearing TWINT releases SCL, the slave acknowledges every byte
+    static void release() { setByte(CTWCR, bit(CTWINT) | bit(CTWEN) | bit(CTWIE) | bit(CTWEA)); }
+
+    uint8_t readRegister() {
+        if (_pointer >= COUNT) return 0xFF;
+        auto read = reinterpret_cast<TWIRegisterRead>(pgm_read_word(&MAP[_pointer++].read));
+        return read ? read() : 0xFF;
+    }
+
+    void writeRegister(uint8_t val) {
+        if (_pointer >= COUNT) return;
+        auto write = reinterpret_cast<TWIRegisterWrite>(pgm_read_word(&MAP[_pointer++].write));
+        if (write) {
+            write(val);
+        }
+    }
+
+   public:
+    // 7 bit address, with the general call the slave also answers address 0
+    void begin(uint8_t address, bool general_call = false) {
+        _pointer = 0;
+        _select = false;
+        if constexpr (TIMED) {
+            // Normal mode at the full clock, Timer1 counts cycles and wraps after 4 ms at 16 MHz
+            setByte(CTCCR1A, 0);
+            setByte(CTCCR1B, 0b001);
+        }
+        setByte(CTWAR, (address << 1) | (general_call ? bit(CTWGCE) : 0));
+        release();
+    }
+
+    void end() const { setByte(CTWCR, 0); }
+
+    // Register the master selected last
+    uint8_t pointer() const { return _pointer; }
+
+    // Cycles SCL was held from TWINT to the release, last and worst case, only with TIMED
+    uint16_t lastResponseCycles() const {
+        InterruptLock lock;
+        return _last_response_cycles;
+    }
+
+    uint16_t maxResponseCycles() const {
+        InterruptLock lock;
+        return _max_response_cycles;
+    }
+
+    void resetStats() {
+        InterruptLock lock;
+        _max_response_cycles = 0;
+    }
+
+    // Body of the TWI interrupt
+    void onInterrupt() {
+        uint16_t start = TIMED ? readShort(CTCNT1) : 0;
+        switch (twiStatus()) {
+            case TWIStatus::OWN_WRITE:
+            case TWIStatus::OWN_WRITE_ARBITRATION_LOST:
+            case TWIStatus::GENERAL_CALL:
+            case TWIStatus::GENERAL_CALL_ARBITRATION_LOST:
+                _select = true;
+                break;
+
+            case TWIStatus::RECEIVED_ACK:
+            case TWIStatus::RECEIVED_NACK:
+            case TWIStatus::GENERAL_CALL_RECEIVED_ACK:
+            case TWIStatus::GENERAL_CALL_RECEIVED_NACK:
+                if (_select) {
+                    _pointer = readByte(CTWDR);
+                    _select = false;
+                } else {
+                    writeRegister(readByte(CTWDR));
+                }
+                break;
+
+            case TWIStatus::OWN_READ:
+            case TWIStatus::OWN_READ_ARBITRATION_LOST:
+            case TWIStatus::SENT_ACK:
+                setByte(CTWDR, readRegister());
+                break;
+
+            case TWIStatus::BUS_ERROR:
+                // Releases the lines and returns to the unaddressed state
+                setByte(CTWCR, bit(CTWINT) | bit(CTWEN) | bit(CTWIE) | bit(CTWEA) | bit(CTWSTO));
+                return;
+
+            // Stop, repeated start and the end of a read, back to listening for the address
+            default:
+                break;
+        }
+        release();
+        if constexpr (TIMED) {
+            uint16_t elapsed = readShort(CTCNT1) - start + TWI_SLAVE_ENTRY_CYCLES;
+            _last_response_cycles = elapsed;
+            if (elapsed > _max_response_cycles) {
+                _max_response_cycles = elapsed;
+            }
+        }
+    }
+};
+
+// The same hardware as the master, so the two cannot be claimed together, TIMED takes both Timer1 channels as well
+template <bool TIMED = false>
+struct TWISlaveClaim : Claim<Resource::PIN_C4, Resource::PIN_C5, Resource::UNIT_TWI, Resource::VECTOR_TWI,
+                             TIMED ? Resource::TIMER_1_A : Resource::NONE,
+                             TIMED ? Resource::TIMER_1_B : Resource::NONE> {};
+
+// Binds the TWI interrupt to a TWISlave instance
+#define HAL_TWI_SLAVE_ISR(slave) \
+    ISR(TWI_vect) { slave.onInterrupt(); }
+
+}  // namespace hal
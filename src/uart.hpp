@@ -5,7 +5,11 @@
 #include <avr/interrupt.h>
 #include "pins.hpp"
 #include "bitops.hpp"
+#include "fixed.hpp"
+#include "format.hpp"
+#include "resources.hpp"
 #include "ringbuf.hpp"
+#include "usartbus.hpp"
 
 namespace hal {
 
@@ -17,15 +21,6 @@ enum LookaheadMode {
     SKIP_WHITESPACE,
 };
 
-enum Format {
-    BIN = 2,
-    OCT = 8,
-    DEC = 10,
-    HEX = 16,
-};
-
-constexpr auto CUDR0 = 0xC6;
-
 template<uintptr_t BUFSIZE = 64>
 class SerialClass {
 
@@ -70,11 +65,8 @@ public:
         return sendBuffer.empty_capacity();
     }
     
-    static constexpr auto CTXEN0 = 3;
-    static constexpr auto CRXEN0 = 4;
     static constexpr auto CRXCIEn = 7;
     static constexpr auto CUDRIEn = 5;
-    static constexpr uintptr_t CUCSR0B = 0xC1;
     
     // Baud rate setting roughly matches 1 000 000 / baud rate, but not exactly :(
     uint16_t baudRateToSetting(uint32_t baud_rate) {
@@ -115,14 +107,9 @@ public:
         {
             CPD0.setInputMode();
             CPD1.setOutputMode();
-            auto baud_rate_setting = baudRateToSetting(baud_rate);
-            constexpr uintptr_t CUBRR0H = 0xC5;
-            setByte(CUBRR0H, baud_rate_setting >> 8);
-            constexpr uintptr_t CUBRR0L = 0xC4;
-            setByte(CUBRR0L, baud_rate_setting & 0xFF);
+            setBaudSetting(baudRateToSetting(baud_rate));
         
             // Default usart mode
-             constexpr auto CUCSR0C = 0xC2;
              setByte(CUCSR0C, 0x06);
             
             // Enable transmitter and receiver
@@ -145,7 +132,7 @@ public:
         sei();
     }
     
-    static constexpr uintptr_t CUCSRnA = 0xC0;
+    static constexpr uintptr_t CUCSRnA = CUCSR0A;
     
     void flush() {
         while (sendBuffer.count() != 0) {}
@@ -235,6 +222,33 @@ public:
         return print(str);
     }
     
+    // Prints DIGITS decimal places, further places are truncated
+    template <uint8_t INT_BITS, uint8_t FRAC_BITS>
+    uintptr_t print(Fixed<INT_BITS, FRAC_BITS> val, uint8_t digits = 2) {
+        using Fraction = typename std::conditional<(FRAC_BITS <= 28), uint32_t, uint64_t>::type;
+        constexpr Fraction MASK = (static_cast<Fraction>(1) << FRAC_BITS) - 1;
+
+        uintptr_t count = 0;
+        // Works on the magnitude, so the fraction digits come out the same for negative numbers
+        typename Fixed<INT_BITS, FRAC_BITS>::wide_type raw = val.raw();
+        if (raw < 0) {
+            count += write('-');
+            raw = -raw;
+        }
+        count += print(static_cast<long>(raw >> FRAC_BITS));
+        if (digits == 0 || FRAC_BITS == 0) {
+            return count;
+        }
+        count += write('.');
+        Fraction remainder = static_cast<Fraction>(raw) & MASK;
+        for (uint8_t i = 0; i < digits; ++i) {
+            remainder *= 10;
+            count += write(static_cast<uint8_t>('0' + (remainder >> FRAC_BITS)));
+            remainder &= MASK;
+        }
+        return count;
+    }
+
     uintptr_t println(const char* str) {
         auto count = print(str);
         count += print("\r\n");
@@ -247,6 +261,13 @@ public:
         return count;
     }
     
+    template <uint8_t INT_BITS, uint8_t FRAC_BITS>
+    uintptr_t println(Fixed<INT_BITS, FRAC_BITS> val, uint8_t digits = 2) {
+        auto count = print(val, digits);
+        count += print("\r\n");
+        return count;
+    }
+    
     int read() {
         if (avaiable() == 0)
             return -1;
@@ -267,6 +288,9 @@ public:
 
 SerialClass<64> Serial;
 
+struct SerialClaim : Claim<Resource::PIN_D0, Resource::PIN_D1, Resource::UNIT_USART, Resource::VECTOR_USART_RX,
+                           Resource::VECTOR_USART_UDRE> {};
+
 ISR(USART_RX_vect) {
     uint8_t data = readByte(CUDR0);
     Serial.receiveBuffer.add(data);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "bitops.hpp"
+
+namespace hal {
+
+// USART0 registers, shared by Serial and USART SPI, without any interrupt
+constexpr uintptr_t CUDR0 = 0xC6;
+constexpr uintptr_t CUCSR0A = 0xC0;
+constexpr uintptr_t CUCSR0B = 0xC1;
+constexpr uintptr_t CUCSR0C = 0xC2;
+
+// UCSR0A
+constexpr uint8_t CRXC0 = 7;
+constexpr uint8_t CTXC0 = 6;
+constexpr uint8_t CUDRE0 = 5;
+
+// UCSR0B
+constexpr uint8_t CRXEN0 = 4;
+constexpr uint8_t CTXEN0 = 3;
+
+// UBRR0 of the normal and of the SPI master mode of USART0
+void setBaudSetting(uint16_t setting) {
+    constexpr uintptr_t CUBRR0H = 0xC5;
+    setByte(CUBRR0H, setting >> 8);
+    constexpr uintptr_t CUBRR0L = 0xC4;
+    setByte(CUBRR0L, setting & 0xFF);
+}
+
+}  // namespace hal
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "bitops.hpp"
+#include "pins.hpp"
+#include "resources.hpp"
+#include "spibus.hpp"
+#include "usartbus.hpp"
+
+namespace hal {
+
+/*
+ * USART0 in master SPI mode (MSPIM), a second SPI bus next to the SPI unit.
+ * TXD (PD1) is MOSI, RXD (PD0) is MISO and XCK (PD4) is SCK, so it replaces Serial while it runs.
+ * The transmitter is double buffered, the block transfers keep two bytes in flight and the clock never pauses.
+ * Devices are the same SPIDevice values as on the SPI unit, the clock and mode are taken from their settings.
+ *
+ *     constexpr SPIDevice display(CPD7, SPISettings(8000000, SPIMode::MODE0));
+ *     USARTSPI.begin();
+ *     USARTSPI.attach(display);
+ *     USARTSPI.beginTransaction(display);
+ *     USARTSPI.send(frame, sizeof(frame));
+ *     USARTSPI.endTransaction(display);
+ */
+
+class USARTSPIMaster {
+    // UMSEL01:0 = 11 selects master SPI
+    static constexpr uint8_t MSPIM = 0b11 << 6;
+    static constexpr uint8_t CUDORD0 = 2;
+    static constexpr uint8_t CUCPHA0 = 1;
+    static constexpr uint8_t CUCPOL0 = 0;
+
+    static void waitSend() {
+        while (!readBit(CUCSR0A, CUDRE0)) {}
+    }
+
+    static bool received() { return readBit(CUCSR0A, CRXC0); }
+
+    // Mode bits of UCSR0C from the SPCR value of the device
+    static uint8_t control(const SPISettings& settings) {
+        uint8_t res = MSPIM;
+        if (settings.control & static_cast<uint8_t>(SPIBitOrder::LSB_FIRST)) res |= bit(CUDORD0);
+        if (settings.control & static_cast<uint8_t>(SPIMode::MODE1)) res |= bit(CUCPHA0);
+        if (settings.control & static_cast<uint8_t>(SPIMode::MODE2)) res |= bit(CUCPOL0);
+        return res;
+    }
+
+    // SCK is F_CPU / (2 * (UBRR0 + 1)), the same divider as the SPI unit would use
+    static uint16_t baudSetting(const SPISettings& settings) {
+        uint8_t spr = settings.control & 0b11;
+        uint8_t shift = spr == 0b11 ? 7 : 2 * spr + 2;
+        if (settings.status) --shift;
+        return (1 << (shift - 1)) - 1;
+    }
+
+   public:
+    void begin() const {
+        // UBRR0 has to be 0 while the transmitter gets enabled
+        setBaudSetting(0);
+        pinMode(CPD4, OUTPUT);
+        pinMode(CPD1, OUTPUT);
+        pinMode(CPD0, INPUT);
+        setByte(CUCSR0C, MSPIM);
+        setByte(CUCSR0B, bit(CRXEN0) | bit(CTXEN0));
+    }
+
+    // Serial.begin() afterwards brings the normal mode back
+    void end() const {
+        setByte(CUCSR0B, 0);
+        setByte(CUCSR0C, 0);
+    }
+
+    void attach(const SPIDevice& device) const {
+        device.deselect();
+        pinMode(device.chip_select, OUTPUT);
+        device.deselect();
+    }
+
+    void beginTransaction(const SPIDevice& device) const {
+        setByte(CUCSR0C, control(device.settings));
+        setBaudSetting(baudSetting(device.settings));
+        device.select();
+    }
+
+    void endTransaction(const SPIDevice& device) const { device.deselect(); }
+
+    uint8_t transfer(uint8_t data) const {
+        waitSend();
+        setByte(CUDR0, data);
+        while (!received()) {}
+        return readByte(CUDR0);
+    }
+
+    // The next byte goes into the buffer while the previous one shifts, at most two bytes are in flight
+    void transfer(const uint8_t* tx, uint8_t* rx, uint16_t length) const {
+        uint16_t sent = 0;
+        uint16_t done = 0;
+        while (done < length) {
+            if (sent < length && sent - done < 2 && readBit(CUCSR0A, CUDRE0)) {
+                setByte(CUDR0, tx[sent++]);
+            }
+            if (received()) {
+                rx[done++] = readByte(CUDR0);
+            }
+        }
+    }
+
+    // Replies are dropped as they come, so the receiver never overruns
+    void send(const uint8_t* tx, uint16_t length) const {
+        if (length == 0) return;
+        for (uint16_t i = 0; i < length; ++i) {
+            waitSend();
+            // Writing one clears TXC0, it sets again once the last written byte has left
+            setByte(CUCSR0A, bit(CTXC0));
+            setByte(CUDR0, tx[i]);
+            if (received()) {
+                readByte(CUDR0);
+            }
+        }
+        while (!readBit(CUCSR0A, CTXC0)) {}
+        while (received()) {
+            readByte(CUDR0);
+        }
+    }
+
+    void receive(uint8_t* rx, uint16_t length, uint8_t fill = 0xFF) const {
+        uint16_t sent = 0;
+        uint16_t done = 0;
+        while (done < length) {
+            if (sent < length && sent - done < 2 && readBit(CUCSR0A, CUDRE0)) {
+                setByte(CUDR0, fill);
+                ++sent;
+            }
+            if (received()) {
+                rx[done++] = readByte(CUDR0);
+            }
+        }
+    }
+};
+
+USARTSPIMaster USARTSPI;
+
+// The same USART as Serial, so the two cannot be claimed together
+struct USARTSPIClaim
+    : Claim<Resource::PIN_D0, Resource::PIN_D1, Resource::PIN_D4, Resource::UNIT_USART> {};
+
+}  // namespace hal
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * Assertions of the host tests, a failed check prints where it is and the test goes on,
+ * main() returns failures() so ctest sees every test which had one.
+ */
+
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                           \
+    do {                                                                           \
+        if (!(condition)) {                                                        \
+            fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, #condition); \
+            ++check_failures;                                                      \
+        }                                                                          \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected)                                                                        \
+    do {                                                                                                     \
+        long long check_actual = (actual);                                                                   \
+        long long check_expected = (expected);                                                               \
+        if (check_actual != check_expected) {                                                                \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, check_actual, \
+                    check_expected);                                                                         \
+            ++check_failures;                                                                                \
+        }                                                                                                    \
+    } while (0)
+
+inline int failures() {
+    if (check_failures) {
+        fprintf(stderr, "%d checks failed\n", check_failures);
+    }
+    return check_failures != 0;
+}
+
@@ -0,0 +1,363 @@
+// Host tests of FatVolume on FAT16 and FAT32 images built in memory, checked afterwards by walking the FAT
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.hpp"
+#include "fat.hpp"
+
+using namespace hal;
+
+static uint16_t le16(const uint8_t* data) { return data[0] | data[1] << 8; }
+
+static uint32_t le32(const uint8_t* data) { return le16(data) | static_cast<uint32_t>(le16(data + 2)) << 16; }
+
+static void setLe16(uint8_t* data, uint16_t val) {
+    data[0] = val;
+    data[1] = val >> 8;
+}
+
+static void setLe32(uint8_t* data, uint32_t val) {
+    setLe16(data, val);
+    setLe16(data + 2, val >> 16);
+}
+
+// Block device in memory, counting the accesses
+struct Disk {
+    uint8_t* data;
+    uint32_t sectors;
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+
+    uint8_t* sector(uint32_t index) { return data + static_cast<size_t>(index) * FAT_SECTOR_SIZE; }
+
+    bool readBlock(unsigned long block, unsigned char* buffer) {
+        if (block >= sectors) return false;
+        memcpy(buffer, sector(block), FAT_SECTOR_SIZE);
+        ++reads;
+        return true;
+    }
+
+    bool writeBlock(unsigned long block, const unsigned char* buffer) {
+        if (block >= sectors) return false;
+        memcpy(sector(block), buffer, FAT_SECTOR_SIZE);
+        ++writes;
+        return true;
+    }
+};
+
+constexpr uint32_t END_OF_CHAIN = 0x0FFFFFF8;
+constexpr uint16_t CONFIG_REPEATS = 200;
+constexpr char CONFIG_LINES[] = "speed=120\r\nmode=auto\nkp=3\n";
+constexpr uint16_t LOG_LINES = 3000;
+
+/*
+ * A formatted volume as a PC leaves it: a volume label, a deleted entry, CONFIG.TXT in clusters
+ * which do not follow each other and a LOGS directory whose first cluster is full.
+ */
+struct Image {
+    bool fat32;
+    Disk disk;
+    uint32_t start;
+    uint8_t cluster_sectors;
+    uint16_t reserved;
+    uint16_t root_entries;
+    uint32_t fat_sectors;
+    uint32_t fat_start;
+    uint32_t data_start;
+    uint32_t root;
+    uint32_t logs;
+    uint32_t next_free = 2;
+
+    Image(bool is_fat32, bool partitioned) : fat32(is_fat32) {
+        uint32_t total = fat32 ? 80000 : 65536;
+        cluster_sectors = fat32 ? 1 : 4;
+        reserved = fat32 ? 32 : 1;
+        root_entries = fat32 ? 0 : 512;
+        fat_sectors = (total / cluster_sectors * (fat32 ? 4 : 2) + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE + 1;
+        start = partitioned ? 2048 : 0;
+        disk.sectors = start + total;
+        disk.data = static_cast<uint8_t*>(calloc(disk.sectors, FAT_SECTOR_SIZE));
+        fat_start = start + reserved;
+        data_start = fat_start + 2 * fat_sectors + root_entries * 32 / FAT_SECTOR_SIZE;
+
+        uint8_t* boot = disk.sector(start);
+        memcpy(boot, "\xEB\x58\x90MSWIN4.1", 11);
+        setLe16(boot + 0x0B, FAT_SECTOR_SIZE);
+        boot[0x0D] = cluster_sectors;
+        setLe16(boot + 0x0E, reserved);
+        boot[0x10] = 2;
+        setLe16(boot + 0x11, root_entries);
+        boot[0x15] = 0xF8;
+        setLe16(boot + 0x16, fat32 ? 0 : fat_sectors);
+        setLe32(boot + 0x20, total);
+        if (fat32) {
+            setLe32(boot + 0x24, fat_sectors);
+            setLe32(boot + 0x2C, 2);
+            setLe16(boot + 0x30, 1);
+            setLe16(boot + 0x32, 6);
+            uint8_t* fsinfo = disk.sector(start + 1);
+            setLe32(fsinfo, 0x41615252);
+            setLe32(fsinfo + 484, 0x61417272);
+            setLe32(fsinfo + 488, 1234);
+            setLe32(fsinfo + 492, 5);
+            setLe16(fsinfo + 510, 0xAA55);
+        }
+        setLe16(boot + 510, 0xAA55);
+        if (partitioned) {
+            uint8_t* mbr = disk.sector(0);
+            mbr[0] = 0xFA;
+            mbr[0x1C2] = fat32 ? 0x0C : 0x06;
+            setLe32(mbr + 0x1C6, start);
+            setLe32(mbr + 0x1CA, total);
+            setLe16(mbr + 510, 0xAA55);
+        }
+
+        setFat(0, fat32 ? 0x0FFFFFF8 : 0xFFF8);
+        setFat(1, END_OF_CHAIN);
+        if (fat32) {
+            root = allocate(1);
+        }
+
+        // Every second cluster, the gaps stay free
+        uint32_t config_size = (sizeof(CONFIG_LINES) - 1) * CONFIG_REPEATS;
+        uint32_t cluster_bytes = cluster_sectors * FAT_SECTOR_SIZE;
+        uint32_t config_clusters = (config_size + cluster_bytes - 1) / cluster_bytes;
+        uint32_t first_config = next_free;
+        for (uint32_t i = 0; i < config_clusters; ++i) {
+            uint32_t cluster = next_free + 2 * i;
+            setFat(cluster, i + 1 < config_clusters ? cluster + 2 : END_OF_CHAIN);
+            for (uint32_t j = 0; j < cluster_bytes && i * cluster_bytes + j < config_size; ++j) {
+                uint32_t offset = i * cluster_bytes + j;
+                disk.sector(clusterSector(cluster))[j] = CONFIG_LINES[offset % (sizeof(CONFIG_LINES) - 1)];
+            }
+        }
+        next_free += 2 * config_clusters;
+        logs = allocate(1);
+
+        uint8_t* root_dir = rootEntry(0);
+        entry(root_dir, "VOLUME     ", 0x08, 0, 0);
+        entry(root_dir + 32, "\xE5" "ELETED TXT", 0x20, 0, 0);
+        entry(root_dir + 64, "CONFIG  TXT", 0x20, first_config, config_size);
+        entry(root_dir + 96, "LOGS       ", 0x10, logs, 0);
+        uint8_t* logs_dir = disk.sector(clusterSector(logs));
+        entry(logs_dir, ".          ", 0x10, logs, 0);
+        entry(logs_dir + 32, "..         ", 0x10, 0, 0);
+        for (uint16_t i = 2; i < cluster_bytes / 32; ++i) {
+            char name[12];
+            snprintf(name, sizeof(name), "F%07uTXT", i);
+            entry(logs_dir + i * 32, name, 0x20, 0, 0);
+        }
+    }
+
+    ~Image() { free(disk.data); }
+
+    uint32_t clusterSector(uint32_t cluster) const { return data_start + (cluster - 2) * cluster_sectors; }
+
+    uint8_t* fatEntry(uint8_t copy, uint32_t cluster) {
+        uint32_t offset = cluster * (fat32 ? 4 : 2);
+        return disk.sector(fat_start + copy * fat_sectors + offset / FAT_SECTOR_SIZE) + offset % FAT_SECTOR_SIZE;
+    }
+
+    void setFat(uint32_t cluster, uint32_t next) {
+        for (uint8_t copy = 0; copy < 2; ++copy) {
+            if (fat32) {
+                setLe32(fatEntry(copy, cluster), next);
+            } else {
+                setLe16(fatEntry(copy, cluster), next >= END_OF_CHAIN ? 0xFFFF : next);
+            }
+        }
+    }
+
+    uint32_t getFat(uint32_t cluster) {
+        if (fat32) return le32(fatEntry(0, cluster)) & 0x0FFFFFFF;
+        uint32_t next = le16(fatEntry(0, cluster));
+        return next >= 0xFFF8 ? END_OF_CHAIN : next;
+    }
+
+    uint32_t allocate(uint32_t count) {
+        uint32_t first = next_free;
+        for (uint32_t i = 0; i < count; ++i) {
+            setFat(first + i, i + 1 < count ? first + i + 1 : END_OF_CHAIN);
+        }
+        next_free += count;
+        return first;
+    }
+
+    uint8_t* rootEntry(uint16_t index) {
+        uint32_t sector = fat32 ? clusterSector(root) : fat_start + 2 * fat_sectors;
+        return disk.sector(sector + index / 16) + index % 16 * 32;
+    }
+
+    static void entry(uint8_t* data, const char* name, uint8_t attributes, uint32_t cluster, uint32_t size) {
+        memcpy(data, name, 11);
+        data[11] = attributes;
+        setLe16(data + 20, cluster >> 16);
+        setLe16(data + 26, cluster);
+        setLe32(data + 28, size);
+    }
+
+    // Clusters of the chain starting at FIRST, 0 when it is broken
+    uint32_t chainLength(uint32_t first, bool& contiguous) {
+        uint32_t length = 0;
+        contiguous = true;
+        for (uint32_t cluster = first; cluster >= 2 && cluster < END_OF_CHAIN; cluster = getFat(cluster)) {
+            if (getFat(cluster) != cluster + 1 && getFat(cluster) < END_OF_CHAIN) {
+                contiguous = false;
+            }
+            if (++length > disk.sectors) return 0;
+        }
+        return length;
+    }
+
+    // Entry NAME in the directory chain starting at CLUSTER, nullptr when there is none
+    uint8_t* find(uint32_t cluster, const char* name) {
+        for (; cluster >= 2 && cluster < END_OF_CHAIN; cluster = getFat(cluster)) {
+            uint8_t* data = disk.sector(clusterSector(cluster));
+            for (uint32_t i = 0; i < cluster_sectors * FAT_SECTOR_SIZE; i += 32) {
+                if (memcmp(data + i, name, 11) == 0) return data + i;
+            }
+        }
+        return nullptr;
+    }
+
+    // Content of a file as the FAT links it
+    bool matches(const uint8_t* entry, const char* expected, uint32_t length) {
+        uint32_t cluster = le16(entry + 20) << 16 | le16(entry + 26);
+        uint32_t cluster_bytes = cluster_sectors * FAT_SECTOR_SIZE;
+        for (uint32_t offset = 0; offset < length; offset += cluster_bytes) {
+            if (cluster < 2 || cluster >= END_OF_CHAIN) return false;
+            uint32_t chunk = length - offset < cluster_bytes ? length - offset : cluster_bytes;
+            if (memcmp(disk.sector(clusterSector(cluster)), expected + offset, chunk) != 0) return false;
+            cluster = getFat(cluster);
+        }
+        return true;
+    }
+};
+
+static void readConfig(FatVolume<Disk>& volume) {
+    FatVolume<Disk>::File config;
+    CHECK(volume.open(config, "config.txt"));
+    CHECK_EQUAL(config.size(), (sizeof(CONFIG_LINES) - 1) * CONFIG_REPEATS);
+    char line[32];
+    uint16_t lines = 0;
+    const char* expected[] = {"speed=120", "mode=auto", "kp=3"};
+    while (config.readLine(line, sizeof(line))) {
+        CHECK(strcmp(line, expected[lines % 3]) == 0);
+        ++lines;
+    }
+    CHECK_EQUAL(lines, 3 * CONFIG_REPEATS);
+    // Backwards and forwards across the gaps between the clusters
+    const uint32_t positions[] = {5, 5000, 2047, 0, 2048, 4096, 1000, 4095, 511, 512};
+    for (uint32_t position : positions) {
+        CHECK(config.seek(position));
+        CHECK_EQUAL(config.read(), CONFIG_LINES[position % (sizeof(CONFIG_LINES) - 1)]);
+    }
+    CHECK(!config.seek(config.size() + 1));
+    CHECK(config.close());
+}
+
+static void appendLog(Image& image, FatVolume<Disk>& volume, char* expected, uint32_t& length) {
+    FatVolume<Disk>::File log;
+    CHECK(volume.open(log, "LOGS/RUN.CSV", true));
+    CHECK(log.preallocate(100000));
+    CHECK(log.sync());
+    // The run is contiguous, appending inside it reads nothing, not even a FAT sector
+    uint32_t reads = image.disk.reads;
+    length = 0;
+    for (uint16_t i = 0; i < LOG_LINES; ++i) {
+        char line[24];
+        snprintf(line, sizeof(line), "%u,%u\n", i, i * 7);
+        CHECK_EQUAL(log.write(line), strlen(line));
+        strcpy(expected + length, line);
+        length += strlen(line);
+    }
+    CHECK_EQUAL(image.disk.reads, reads);
+    CHECK_EQUAL(log.size(), length);
+    CHECK(log.trim());
+    CHECK(log.close());
+
+    // Reopened, appended at the end and read back
+    FatVolume<Disk>::File again;
+    CHECK(volume.open(again, "logs/run.csv"));
+    CHECK(again.seekEnd());
+    CHECK_EQUAL(again.write("end\n"), 4);
+    CHECK(again.close());
+    strcpy(expected + length, "end\n");
+    length += 4;
+
+    FatVolume<Disk>::File check;
+    CHECK(volume.open(check, "LOGS/RUN.CSV"));
+    char line[24];
+    uint16_t lines = 0;
+    while (check.readLine(line, sizeof(line))) {
+        ++lines;
+    }
+    CHECK_EQUAL(lines, LOG_LINES + 1);
+    CHECK(strcmp(line, "end") == 0);
+}
+
+static void volume(bool fat32, bool partitioned) {
+    Image image(fat32, partitioned);
+    FatVolume<Disk> volume(image.disk);
+    CHECK(volume.mount());
+    CHECK(volume.isFat32() == fat32);
+    CHECK_EQUAL(volume.clusterSize(), image.cluster_sectors * FAT_SECTOR_SIZE);
+
+    readConfig(volume);
+    static char expected[40000];
+    uint32_t length;
+    appendLog(image, volume, expected, length);
+
+    FatVolume<Disk>::File file;
+    CHECK(!volume.open(file, "LOGS/NONE.TXT"));
+    CHECK(!volume.open(file, "LOGS"));
+    CHECK(!volume.open(file, "NODIR/RUN.CSV", true));
+    CHECK(!volume.open(file, "TOOLONGNAME.TXT", true));
+    // A file in the root takes the deleted entry
+    CHECK(volume.open(file, "NEW.TXT", true));
+    CHECK(file.close());
+    CHECK(memcmp(image.rootEntry(1), "NEW     TXT", 11) == 0);
+
+    // Both FAT copies are the same
+    uint8_t* first_fat = image.disk.sector(image.fat_start);
+    CHECK(memcmp(first_fat, first_fat + image.fat_sectors * FAT_SECTOR_SIZE, image.fat_sectors * FAT_SECTOR_SIZE) ==
+          0);
+    // The full directory grew by a cluster
+    bool contiguous;
+    CHECK_EQUAL(image.chainLength(image.logs, contiguous), 2);
+    // Trimmed to the clusters the content needs, in one run, which the FAT links as well
+    uint8_t* run = image.find(image.logs, "RUN     CSV");
+    CHECK(run);
+    if (run) {
+        CHECK_EQUAL(le32(run + 28), length);
+        uint32_t cluster_bytes = image.cluster_sectors * FAT_SECTOR_SIZE;
+        CHECK_EQUAL(image.chainLength(le16(run + 20) << 16 | le16(run + 26), contiguous),
+                    (length + cluster_bytes - 1) / cluster_bytes);
+        CHECK(contiguous);
+        CHECK(image.matches(run, expected, length));
+    }
+    if (fat32) {
+        // The free count is unknown after allocating, the PC recounts it
+        CHECK_EQUAL(le32(image.disk.sector(image.start + 1) + 488), 0xFFFFFFFF);
+    }
+}
+
+static void fat12Refused() {
+    Image image(false, false);
+    // A small volume has fewer than 4085 clusters
+    setLe32(image.disk.sector(0) + 0x20, 8000);
+    FatVolume<Disk> volume(image.disk);
+    CHECK(!volume.mount());
+}
+
+int main() {
+    volume(false, false);
+    volume(false, true);
+    volume(true, false);
+    volume(true, true);
+    fat12Refused();
+    return failures();
+}
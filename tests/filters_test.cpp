@@ -0,0 +1,172 @@
+// Host tests of the sample filters against straightforward reference implementations
+
+#include <math.h>
+#include <stdint.h>
+
+#include "check.hpp"
+#include "filters.hpp"
+
+using namespace hal;
+
+// Reproducible noise, 16 bits per call
+static uint16_t noise(uint32_t& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 16;
+}
+
+template <uint8_t N>
+static void movingAverage() {
+    MovingAverage<N> filter;
+    uint16_t window[N];
+    uint32_t state = N;
+    CHECK_EQUAL(filter.add(700), 700);
+    CHECK_EQUAL(filter.value(), 700);
+    for (uint8_t i = 0; i < N; ++i) {
+        window[i] = 700;
+    }
+    for (uint16_t i = 0; i < 2000; ++i) {
+        uint16_t sample = noise(state) % 1024;
+        window[i % N] = sample;
+        uint32_t sum = 0;
+        for (uint8_t j = 0; j < N; ++j) {
+            sum += window[j];
+        }
+        CHECK_EQUAL(filter.add(sample), sum / N);
+    }
+    filter.reset();
+    CHECK_EQUAL(filter.add(3), 3);
+}
+
+template <uint8_t SHIFT>
+static void exponentialFilter() {
+    ExponentialFilter<SHIFT> filter;
+    CHECK_EQUAL(filter.add(0), 0);
+    // Step response, y[k] = 1000 * (1 - (1 - 2^-SHIFT)^k), the rounding stays within about one count
+    double decay = 1.0 - 1.0 / (1 << SHIFT);
+    for (uint16_t k = 1; k < 40 << SHIFT; ++k) {
+        double expected = 1000.0 * (1.0 - pow(decay, k));
+        double actual = filter.add(1000);
+        CHECK(fabs(actual - expected) < 1.5);
+    }
+    // Settles on the input exactly, from below and from above
+    CHECK_EQUAL(filter.value(), 1000);
+    filter.reset();
+    CHECK_EQUAL(filter.add(1023), 1023);
+    for (uint16_t k = 0; k < 40 << SHIFT; ++k) {
+        filter.add(0);
+    }
+    CHECK_EQUAL(filter.value(), 0);
+}
+
+template <uint8_t N>
+static void medianFilter(uint16_t range) {
+    MedianFilter<N> filter;
+    uint16_t window[N];
+    uint32_t state = range;
+    CHECK_EQUAL(filter.add(5), 5);
+    for (uint8_t i = 0; i < N; ++i) {
+        window[i] = 5;
+    }
+    for (uint16_t i = 0; i < 2000; ++i) {
+        // Small ranges give many equal samples
+        uint16_t sample = noise(state) % range;
+        window[i % N] = sample;
+        uint16_t sorted[N];
+        for (uint8_t j = 0; j < N; ++j) {
+            uint8_t k = j;
+            for (; k > 0 && sorted[k - 1] > window[j]; --k) {
+                sorted[k] = sorted[k - 1];
+            }
+            sorted[k] = window[j];
+        }
+        CHECK_EQUAL(filter.add(sample), sorted[N / 2]);
+    }
+}
+
+static void medianRemovesSpikes() {
+    MedianFilter<3> filter;
+    filter.add(100);
+    CHECK_EQUAL(filter.add(1023), 100);
+    CHECK_EQUAL(filter.add(101), 101);
+    CHECK_EQUAL(filter.add(0), 101);
+    CHECK_EQUAL(filter.add(102), 101);
+    CHECK_EQUAL(filter.add(103), 102);
+}
+
+// Butterworth low pass at a tenth of the sample rate
+constexpr double B0 = 0.0674552738890719;
+constexpr double B1 = 2 * B0;
+constexpr double B2 = B0;
+constexpr double A1 = -1.1429805025399011;
+constexpr double A2 = 0.4128015980961886;
+constexpr BiquadCoefficients LOW_PASS = BiquadCoefficients::from(B0, B1, B2, A1, A2);
+
+static void biquadCoefficients() {
+    CHECK_EQUAL(LOW_PASS.b0, 1105);
+    CHECK_EQUAL(LOW_PASS.a1, -18727);
+    CHECK_EQUAL(LOW_PASS.a2, 6763);
+    constexpr BiquadCoefficients EDGES = BiquadCoefficients::from(1.99993896484375, -2.0, 0, 0, 0);
+    CHECK_EQUAL(EDGES.b0, INT16_MAX);
+    CHECK_EQUAL(EDGES.b1, INT16_MIN);
+}
+
+static void biquadResponse() {
+    Biquad<LOW_PASS> filter;
+    // Primed on the first sample, a constant input stays where it is
+    for (uint8_t i = 0; i < 50; ++i) {
+        CHECK_EQUAL(filter.add(-300), -300);
+    }
+    filter.reset();
+
+    // Against the same filter in double precision, the Q2.14 rounding stays within a few counts
+    double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    double worst = 0;
+    uint32_t state = 1;
+    filter.add(0);
+    for (uint16_t i = 0; i < 5000; ++i) {
+        int16_t sample = static_cast<int16_t>(noise(state) % 2048) - 1024;
+        double y = B0 * sample + B1 * x1 + B2 * x2 - A1 * y1 - A2 * y2;
+        x2 = x1;
+        x1 = sample;
+        y2 = y1;
+        y1 = y;
+        double error = fabs(filter.add(sample) - y);
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    CHECK(worst < 4.0);
+
+    // Full scale steps overshoot past int16_t and saturate instead of wrapping
+    Biquad<BiquadCoefficients::from(1.5, 0, 0, 0, 0)> gain;
+    CHECK_EQUAL(gain.add(30000), INT16_MAX);
+    CHECK_EQUAL(gain.add(-30000), INT16_MIN);
+    CHECK_EQUAL(gain.add(1000), 1500);
+
+    // Five full scale products pass int32_t, such coefficients get the wide sum
+    Biquad<BiquadCoefficients::from(1.99, 1.99, 1.99, 0, 0)> wide;
+    CHECK_EQUAL(wide.add(INT16_MIN), INT16_MIN);
+    CHECK_EQUAL(wide.add(INT16_MAX), INT16_MIN);
+    CHECK_EQUAL(wide.add(INT16_MAX), INT16_MAX);
+    CHECK_EQUAL(wide.add(INT16_MAX), INT16_MAX);
+    CHECK_EQUAL(wide.add(-1000), INT16_MAX);
+    CHECK_EQUAL(wide.add(-1000), INT16_MAX);
+    CHECK_EQUAL(wide.add(-1000), -5970);
+}
+
+int main() {
+    movingAverage<1>();
+    movingAverage<4>();
+    movingAverage<5>();
+    movingAverage<64>();
+    exponentialFilter<1>();
+    exponentialFilter<3>();
+    exponentialFilter<6>();
+    medianFilter<3>(1024);
+    medianFilter<5>(4);
+    medianFilter<9>(1024);
+    medianRemovesSpikes();
+    biquadCoefficients();
+    biquadResponse();
+    return failures();
+}
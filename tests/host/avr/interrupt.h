@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand-in for the tests, interrupt handlers become plain functions which are never called
+#define ISR(vector, ...) extern "C" void vector(void)
+#define cli() \
+    do {      \
+    } while (0)
+#define sei() \
+    do {      \
+    } while (0)
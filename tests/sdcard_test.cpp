@@ -0,0 +1,484 @@
+// Host tests of SDCard against a model of a card in SPI mode, byte by byte as the bus clocks them
+
+#include <stdint.h>
+#include <string.h>
+
+#include "check.hpp"
+#include "sdcard.hpp"
+
+using namespace hal;
+
+// Own CRC implementations, bit by bit from the polynomials, so the driver is not checked against itself
+static uint8_t crc7(const uint8_t* data, uint8_t length) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; ++i) {
+        for (int8_t bit = 7; bit >= 0; --bit) {
+            bool feedback = ((crc >> 6) ^ (data[i] >> bit)) & 1;
+            crc = (crc << 1) & 0x7F;
+            if (feedback) {
+                crc ^= 0x09;
+            }
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t* data, uint16_t length) {
+    uint16_t crc = 0;
+    for (uint16_t i = 0; i < length; ++i) {
+        for (int8_t bit = 7; bit >= 0; --bit) {
+            bool feedback = ((crc >> 15) ^ (data[i] >> bit)) & 1;
+            crc = crc << 1;
+            if (feedback) {
+                crc ^= 0x1021;
+            }
+        }
+    }
+    return crc;
+}
+
+// Sets a field of the CSD by its bit positions in the specification, bit 127 is the first bit of byte 0
+static void setCsdBits(uint8_t* csd, uint8_t high, uint8_t low, uint32_t value) {
+    for (uint8_t bit = low; bit <= high; ++bit) {
+        uint8_t index = 15 - bit / 8;
+        uint8_t mask = 1 << (bit % 8);
+        csd[index] = (value >> (bit - low)) & 1 ? csd[index] | mask : csd[index] & ~mask;
+    }
+}
+
+constexpr uint16_t MODEL_BLOCKS = 64;
+
+/*
+ * The card side of the SPI protocol, every clocked byte goes in and the answer comes out. Answers wait in a queue,
+ * an empty queue reads as 0xFF, except while the card is busy programming, then it holds MISO low.
+ */
+struct CardModel {
+    // Configuration of the test
+    bool present = true;
+    bool version2 = true;
+    bool high_capacity = true;
+    // Commands with a wrong CRC are refused while CRC checking is on
+    bool crc_checking = false;
+    // Corrupts the next data block sent to the host
+    bool corrupt_read = false;
+    uint8_t busy_bytes = 3;
+    uint8_t csd[16] = {};
+
+    // State of the card
+    bool idle = true;
+    bool app_command = false;
+    uint8_t init_polls = 0;
+    uint8_t storage[MODEL_BLOCKS][SD_BLOCK_SIZE] = {};
+    uint8_t frame[6];
+    uint8_t frame_length = 0;
+    uint8_t answer[SD_BLOCK_SIZE + 16];
+    uint16_t answer_head = 0;
+    uint16_t answer_length = 0;
+    uint16_t busy = 0;
+
+    enum class Mode { COMMAND, WRITE_SINGLE, WRITE_MULTIPLE, READ_MULTIPLE };
+    Mode mode = Mode::COMMAND;
+    uint32_t block = 0;
+    // Data block coming from the host, token, data and CRC
+    bool receiving = false;
+    uint8_t incoming[SD_BLOCK_SIZE + 2];
+    uint16_t incoming_length = 0;
+
+    // What the tests look at
+    uint32_t erase_count = 0;
+    uint16_t bad_frames = 0;
+
+    void queue(uint8_t val) { answer[answer_length++] = val; }
+
+    void clear() {
+        answer_head = 0;
+        answer_length = 0;
+    }
+
+    // Gap, start token, data and CRC
+    void queueBlock(const uint8_t* data, uint16_t length) {
+        queue(0xFF);
+        queue(0xFE);
+        uint16_t first = answer_length;
+        for (uint16_t i = 0; i < length; ++i) {
+            queue(data[i]);
+        }
+        uint16_t crc = crc16(data, length);
+        queue(crc >> 8);
+        queue(crc);
+        if (corrupt_read) {
+            answer[first] ^= 0x10;
+            corrupt_read = false;
+        }
+    }
+
+    void respond(uint8_t r1) {
+        clear();
+        // One byte of NCR before the answer
+        queue(0xFF);
+        queue(r1);
+    }
+
+    // Block number from the argument, SDSC cards take byte addresses
+    bool locate(uint32_t arg) {
+        if (!high_capacity) {
+            if (arg % SD_BLOCK_SIZE) return false;
+            arg /= SD_BLOCK_SIZE;
+        }
+        block = arg;
+        return block < MODEL_BLOCKS;
+    }
+
+    void execute() {
+        uint8_t index = frame[0] & 0x3F;
+        uint32_t arg = static_cast<uint32_t>(frame[1]) << 24 | static_cast<uint32_t>(frame[2]) << 16 |
+                       static_cast<uint32_t>(frame[3]) << 8 | frame[4];
+        // CMD0 and CMD8 are always checked, the rest only once CRC_ON_OFF enabled it
+        if ((crc_checking || index == 0 || index == 8) && (frame[5] >> 1) != crc7(frame, 5)) {
+            ++bad_frames;
+            respond(0x08 | (idle ? 0x01 : 0));
+            return;
+        }
+        bool app = app_command;
+        app_command = false;
+        uint8_t state = idle ? 0x01 : 0x00;
+        if (app) {
+            switch (index) {
+                case 41:
+                    // Takes a few polls, a version 1 host gets no high capacity card
+                    if (++init_polls >= 3 && (!high_capacity || (arg & (1UL << 30)))) {
+                        idle = false;
+                    }
+                    respond(idle ? 0x01 : 0x00);
+                    return;
+                case 23:
+                    erase_count = arg & 0x7FFFFF;
+                    respond(state);
+                    return;
+            }
+        }
+        switch (index) {
+            case 0:
+                idle = true;
+                init_polls = 0;
+                crc_checking = false;
+                mode = Mode::COMMAND;
+                respond(0x01);
+                return;
+            case 8:
+                if (!version2) {
+                    respond(0x05);
+                    return;
+                }
+                respond(state);
+                queue(0x00);
+                queue(0x00);
+                queue(arg >> 8 & 0x0F);
+                queue(arg);
+                return;
+            case 9:
+                respond(state);
+                queueBlock(csd, sizeof(csd));
+                return;
+            case 12:
+                mode = Mode::COMMAND;
+                clear();
+                // The stuff byte right after the command is garbage
+                queue(0x3F);
+                queue(0x00);
+                return;
+            case 16:
+                respond(arg == SD_BLOCK_SIZE ? state : 0x40);
+                return;
+            case 17:
+            case 18:
+                if (idle || !locate(arg)) {
+                    respond(0x40);
+                    return;
+                }
+                respond(0x00);
+                if (index == 18) {
+                    mode = Mode::READ_MULTIPLE;
+                    return;
+                }
+                queueBlock(storage[block], SD_BLOCK_SIZE);
+                return;
+            case 24:
+            case 25:
+                if (idle || !locate(arg)) {
+                    respond(0x40);
+                    return;
+                }
+                mode = index == 24 ? Mode::WRITE_SINGLE : Mode::WRITE_MULTIPLE;
+                respond(0x00);
+                return;
+            case 55:
+                app_command = true;
+                respond(state);
+                return;
+            case 58:
+                respond(state);
+                queue(0x80 | (high_capacity ? 0x40 : 0));
+                queue(0xFF);
+                queue(0x80);
+                queue(0x00);
+                return;
+            case 59:
+                crc_checking = arg & 1;
+                respond(state);
+                return;
+        }
+        respond(state | 0x04);
+    }
+
+    // Data block or stop token of a write, byte by byte
+    void writeByte(uint8_t val) {
+        if (!receiving) {
+            if (mode == Mode::WRITE_MULTIPLE && val == 0xFD) {
+                mode = Mode::COMMAND;
+                clear();
+                // One byte passes before the card signals busy
+                queue(0xFF);
+                busy = busy_bytes + 1;
+                return;
+            }
+            if (val == (mode == Mode::WRITE_SINGLE ? 0xFE : 0xFC)) {
+                receiving = true;
+                incoming_length = 0;
+            }
+            return;
+        }
+        incoming[incoming_length++] = val;
+        if (incoming_length < sizeof(incoming)) return;
+        receiving = false;
+        uint16_t crc = incoming[SD_BLOCK_SIZE] << 8 | incoming[SD_BLOCK_SIZE + 1];
+        clear();
+        if (crc_checking && crc != crc16(incoming, SD_BLOCK_SIZE)) {
+            queue(0xE0 | 0x0B);
+            mode = Mode::COMMAND;
+            return;
+        }
+        if (block >= MODEL_BLOCKS) {
+            queue(0xE0 | 0x0D);
+            mode = Mode::COMMAND;
+            return;
+        }
+        memcpy(storage[block++], incoming, SD_BLOCK_SIZE);
+        queue(0xE0 | 0x05);
+        busy = busy_bytes;
+        if (mode == Mode::WRITE_SINGLE) {
+            mode = Mode::COMMAND;
+        }
+    }
+
+    uint8_t exchange(uint8_t mosi) {
+        if (!present) return 0xFF;
+        // Commands start with 01 in the top bits, also in the middle of a multiple block read
+        if (frame_length > 0 || (!receiving && (mode == Mode::COMMAND || mode == Mode::READ_MULTIPLE) &&
+                                 (mosi & 0xC0) == 0x40)) {
+            frame[frame_length++] = mosi;
+            if (frame_length == sizeof(frame)) {
+                frame_length = 0;
+                execute();
+            }
+            return 0xFF;
+        }
+        if (mode == Mode::WRITE_SINGLE || mode == Mode::WRITE_MULTIPLE) {
+            if (answer_head == answer_length && busy == 0) {
+                writeByte(mosi);
+                return 0xFF;
+            }
+        }
+        if (answer_head < answer_length) return answer[answer_head++];
+        if (busy > 0) {
+            --busy;
+            return 0x00;
+        }
+        if (mode == Mode::READ_MULTIPLE) {
+            // Out of range error token
+            if (block >= MODEL_BLOCKS) return 0x08;
+            clear();
+            queueBlock(storage[block++], SD_BLOCK_SIZE);
+            return answer[answer_head++];
+        }
+        return 0xFF;
+    }
+};
+
+CardModel model;
+
+// The blocking part of the SPI unit's interface, the chip select is a pin in host memory
+struct ModelBus {
+    uint32_t clocks = 0;
+    bool selected = false;
+
+    void attach(const SPIDevice&) {}
+
+    void beginTransaction(const SPIDevice& device) {
+        device.select();
+        selected = true;
+    }
+
+    void endTransaction(const SPIDevice& device) {
+        device.deselect();
+        selected = false;
+    }
+
+    uint8_t transfer(uint8_t data) {
+        // About 16 bytes per millisecond, the driver's timeouts run out on a silent card
+        if (++clocks % 16 == 0) {
+            ctime = ctime + 1;
+        }
+        return model.exchange(data);
+    }
+
+    void send(const uint8_t* tx, uint16_t length) {
+        while (length--) {
+            transfer(*tx++);
+        }
+    }
+
+    void receive(uint8_t* rx, uint16_t length, uint8_t fill = 0xFF) {
+        while (length--) {
+            *rx++ = transfer(fill);
+        }
+    }
+};
+
+ModelBus bus;
+
+// PINx, DDRx and PORTx of the chip select
+uint8_t port[3];
+const DigitalPin card_select(reinterpret_cast<uintptr_t>(&port[1]), reinterpret_cast<uintptr_t>(&port[2]),
+                             reinterpret_cast<uintptr_t>(&port[0]), 4);
+
+static bool deselected() { return (port[2] & (1 << 4)) && !bus.selected; }
+
+static void fill(uint8_t* data, uint8_t seed) {
+    for (uint16_t i = 0; i < SD_BLOCK_SIZE; ++i) {
+        data[i] = static_cast<uint8_t>(i * 7 + seed);
+    }
+}
+
+static void resetModel() {
+    model = CardModel();
+    bus = ModelBus();
+    ctime = 0;
+}
+
+template <bool CRC>
+static void highCapacity() {
+    resetModel();
+    // Version 2 CSD of a 32 GB card, C_SIZE 0xEDBF, the middle byte above 0x7F
+    setCsdBits(model.csd, 127, 126, 1);
+    setCsdBits(model.csd, 69, 48, 0xEDBF);
+    SDCard<bus, CRC> card(card_select);
+    CHECK(card.begin());
+    CHECK(card.highCapacity());
+    CHECK(model.crc_checking == CRC);
+    CHECK(deselected());
+    CHECK_EQUAL(card.blockCount(), (0xEDBFUL + 1) * 1024);
+
+    uint8_t data[SD_BLOCK_SIZE];
+    uint8_t back[SD_BLOCK_SIZE];
+    fill(data, 1);
+    CHECK(card.writeBlock(5, data));
+    CHECK(deselected());
+    CHECK(memcmp(model.storage[5], data, SD_BLOCK_SIZE) == 0);
+    CHECK(card.readBlock(5, back));
+    CHECK(memcmp(back, data, SD_BLOCK_SIZE) == 0);
+    CHECK(!card.readBlock(MODEL_BLOCKS, back));
+    CHECK(card.error() == SDError::COMMAND);
+
+    // Streamed writes pre-erase, the stop waits for the last block to be programmed
+    CHECK(card.writeStart(10, 4));
+    CHECK_EQUAL(model.erase_count, 4);
+    for (uint8_t i = 0; i < 4; ++i) {
+        fill(data, 10 + i);
+        CHECK(card.writeData(data));
+    }
+    CHECK(card.writeStop());
+    CHECK(deselected());
+    CHECK(!card.busy());
+    for (uint8_t i = 0; i < 4; ++i) {
+        fill(data, 10 + i);
+        CHECK(memcmp(model.storage[10 + i], data, SD_BLOCK_SIZE) == 0);
+    }
+
+    // Streamed reads, the card keeps sending blocks until the stop command comes in between
+    CHECK(card.readStart(10));
+    for (uint8_t i = 0; i < 4; ++i) {
+        fill(data, 10 + i);
+        CHECK(card.readData(back));
+        CHECK(memcmp(back, data, SD_BLOCK_SIZE) == 0);
+    }
+    CHECK(card.readStop());
+    CHECK(deselected());
+    // Commands go through as usual afterwards
+    CHECK(card.readBlock(5, back));
+    fill(data, 1);
+    CHECK(memcmp(back, data, SD_BLOCK_SIZE) == 0);
+    CHECK_EQUAL(model.bad_frames, 0);
+}
+
+static void standardCapacity() {
+    resetModel();
+    model.version2 = false;
+    model.high_capacity = false;
+    // Version 1 CSD, C_SIZE 0xF2F, C_SIZE_MULT 7, 1024 byte blocks, a 256 MB card
+    setCsdBits(model.csd, 127, 126, 0);
+    setCsdBits(model.csd, 83, 80, 10);
+    setCsdBits(model.csd, 73, 62, 0xF2F);
+    setCsdBits(model.csd, 49, 47, 7);
+    SDCard<bus> card(card_select);
+    CHECK(card.begin());
+    CHECK(!card.highCapacity());
+    CHECK_EQUAL(card.blockCount(), (0xF2FUL + 1) * (1 << (7 + 2)) * 1024 / SD_BLOCK_SIZE);
+
+    // Byte addresses on the wire, the model refuses anything not on a block boundary
+    uint8_t data[SD_BLOCK_SIZE];
+    uint8_t back[SD_BLOCK_SIZE];
+    fill(data, 3);
+    CHECK(card.writeBlock(7, data));
+    CHECK(memcmp(model.storage[7], data, SD_BLOCK_SIZE) == 0);
+    CHECK(card.readBlock(7, back));
+    CHECK(memcmp(back, data, SD_BLOCK_SIZE) == 0);
+    CHECK_EQUAL(model.bad_frames, 0);
+}
+
+static void crcErrors() {
+    resetModel();
+    setCsdBits(model.csd, 127, 126, 1);
+    SDCard<bus> card(card_select);
+    CHECK(card.begin());
+    uint8_t data[SD_BLOCK_SIZE];
+    fill(data, 5);
+    CHECK(card.writeBlock(1, data));
+    model.corrupt_read = true;
+    CHECK(!card.readBlock(1, data));
+    CHECK(card.error() == SDError::CRC);
+    CHECK(deselected());
+    // The next read is fine again
+    CHECK(card.readBlock(1, data));
+}
+
+static void noCard() {
+    resetModel();
+    model.present = false;
+    SDCard<bus> card(card_select);
+    CHECK(!card.begin());
+    CHECK(card.error() == SDError::NO_CARD);
+    CHECK(!card.initialized());
+    CHECK(deselected());
+    // Gave up after the initialization timeout, not at once
+    CHECK(ctime >= 1000);
+}
+
+int main() {
+    highCapacity<true>();
+    highCapacity<false>();
+    standardCapacity();
+    crcErrors();
+    noCard();
+    return failures();
+}
@@ -0,0 +1,94 @@
+/*
+ * Reads the session SDLogger left on a card and writes its records, back to back as they were logged.
+ * Runs on the PC, the card is read raw through its block device:
+ *
+ *     g++ -std=c++20 -O2 -Isrc tools/sdlogdump.cpp -o sdlogdump
+ *     sudo ./sdlogdump /dev/sdb 1000000 samples.bin
+ *
+ * The summary goes to stderr, the records to the output file or stdout.
+ * The session ends at the first block which does not continue it, a torn last block is left out.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdlogblock.hpp"
+
+using namespace hal;
+
+static bool readBlock(FILE* device, uint64_t block, uint8_t* data) {
+    if (fseeko(device, static_cast<off_t>(block * SD_LOG_BLOCK_SIZE), SEEK_SET) != 0) return false;
+    return fread(data, 1, SD_LOG_BLOCK_SIZE, device) == SD_LOG_BLOCK_SIZE;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s DEVICE FIRST_BLOCK [OUTPUT]\n", argv[0]);
+        return 2;
+    }
+    FILE* device = fopen(argv[1], "rb");
+    if (!device) {
+        perror(argv[1]);
+        return 1;
+    }
+    FILE* output = argc > 3 ? fopen(argv[3], "wb") : stdout;
+    if (!output) {
+        perror(argv[3]);
+        return 1;
+    }
+    uint64_t first = strtoull(argv[2], nullptr, 0);
+
+    uint8_t block[SD_LOG_BLOCK_SIZE];
+    SDLogHeader header;
+    uint16_t session = 0;
+    uint16_t record_size = 0;
+    uint32_t sequence = 0;
+    uint64_t records = 0;
+    uint64_t lost = 0;
+    const char* reason = "end of the device";
+    while (readBlock(device, first + sequence, block)) {
+        memcpy(&header, block, sizeof(header));
+        uint32_t trailer;
+        memcpy(&trailer, block + SD_LOG_BLOCK_SIZE - sizeof(trailer), sizeof(trailer));
+        if (sequence == 0) {
+            if (header.magic != SD_LOG_MAGIC) {
+                fprintf(stderr, "no log at block %llu\n", static_cast<unsigned long long>(first));
+                return 1;
+            }
+            session = header.session;
+            record_size = header.record_size;
+        }
+        if (header.magic != SD_LOG_MAGIC || header.session != session) {
+            reason = "block of an older session";
+            break;
+        }
+        if (header.sequence != sequence || trailer != sequence) {
+            reason = "block out of sequence or torn";
+            break;
+        }
+        if (record_size == 0 || header.record_size != record_size || header.records * record_size > SD_LOG_PAYLOAD) {
+            reason = "damaged header";
+            break;
+        }
+        fwrite(block + sizeof(header), record_size, header.records, output);
+        records += header.records;
+        lost += header.lost;
+        ++sequence;
+        // Only the last block of a session is partial
+        if (header.records < SD_LOG_PAYLOAD / record_size) {
+            reason = "session closed";
+            break;
+        }
+    }
+
+    fprintf(stderr, "session %u: %lu blocks, %llu records of %u bytes, %llu lost, stopped at %s\n", session,
+            static_cast<unsigned long>(sequence), static_cast<unsigned long long>(records), record_size,
+            static_cast<unsigned long long>(lost), reason);
+    fclose(device);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}